@@ -13,7 +13,7 @@ public:
 		MD5_Init(&ctx);
 	}
 
-	void append(void *data, uint32_t size)
+	void append(const void *data, uint32_t size)
 	{
 		MD5_Update(&ctx, data, size);
 	}
@@ -0,0 +1,105 @@
+#ifndef HTTP_FAST_PARSER_HPP_
+#define HTTP_FAST_PARSER_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "base/utils/str_view.hpp"
+
+namespace cppbase {
+
+struct HTTPHeaderField {
+	StrView name_;
+	StrView value_;
+};
+
+/* The tokens of the request head, they refer to the parsed bytes */
+struct HTTPRequestHead {
+	enum {
+		HTTP_MAX_HEADERS = 64,
+	};
+
+	HTTPRequestHead(): minor_version_(0), header_cnt_(0) {
+	}
+
+	StrView method_;
+	StrView path_;
+	int minor_version_;
+	HTTPHeaderField headers_[HTTP_MAX_HEADERS];
+	uint32_t header_cnt_;
+};
+
+/*
+The HTTP/1.x request head parser in the way of picohttpparser.
+The bytes are scanned by SSE4.2 or AVX2 to find the token and line boundaries when the CPU
+supports them. It keeps no state and allocates nothing, so the head is parsed again from the
+start when more bytes come.
+*/
+class HTTPFastParser {
+public:
+	enum {
+		HTTP_HEAD_ERROR = -1,
+		HTTP_HEAD_INCOMPLETE = -2,
+	};
+
+	/*
+	Return Value:
+		>0: The bytes of the head including the empty line;
+		HTTP_HEAD_INCOMPLETE: The head needs more bytes;
+		HTTP_HEAD_ERROR: The bytes are not a valid request, or there are more than HTTP_MAX_HEADERS headers;
+	*/
+	static int parse_request(const char *data, size_t len, HTTPRequestHead &head);
+
+	/* The SIMD is used if the CPU supports it, disable it to compare with the scalar codes */
+	static void enable_simd(bool enable);
+};
+
+/*
+Decode the chunked body in place. The chunk data is returned as the views into the bytes,
+the chunk extensions and trailers are skipped.
+*/
+class HTTPChunkedDecoder {
+public:
+	enum Result {
+		/* One piece of the chunk data is got */
+		CHUNK_DATA,
+		/* All bytes are consumed, more are needed */
+		CHUNK_MORE,
+		/* The body ends with the last chunk and the trailers */
+		CHUNK_DONE,
+		CHUNK_ERROR,
+	};
+
+	HTTPChunkedDecoder() {
+		reset();
+	}
+
+	void reset(void);
+	/*
+	Param:
+		used: The bytes consumed, the left ones should be passed again
+		piece: The chunk data when CHUNK_DATA is returned
+	*/
+	Result decode(const char *data, size_t len, size_t &used, StrView &piece);
+
+private:
+	enum State {
+		CHUNK_SIZE,
+		CHUNK_EXT,
+		CHUNK_SIZE_LF,
+		CHUNK_BODY,
+		CHUNK_BODY_CR,
+		CHUNK_BODY_LF,
+		CHUNK_TRAILER_START,
+		CHUNK_TRAILER_LINE,
+		CHUNK_TRAILER_END_LF,
+	};
+
+	State state_;
+	uint32_t size_digits_;
+	uint64_t left_;
+};
+
+}
+
+#endif
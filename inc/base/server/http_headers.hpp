@@ -0,0 +1,50 @@
+#ifndef HTTP_HEADERS_HPP_
+#define HTTP_HEADERS_HPP_
+
+#include "base/utils/str_view.hpp"
+
+namespace cppbase {
+
+/* The well-known request headers, they are found by the id without comparing the names */
+enum HTTPHeaderId {
+	HTTP_HEADER_HOST,
+	HTTP_HEADER_CONTENT_LENGTH,
+	HTTP_HEADER_CONTENT_TYPE,
+	HTTP_HEADER_CONTENT_ENCODING,
+	HTTP_HEADER_CONNECTION,
+	HTTP_HEADER_KEEP_ALIVE,
+	HTTP_HEADER_TRANSFER_ENCODING,
+	HTTP_HEADER_UPGRADE,
+	HTTP_HEADER_EXPECT,
+	HTTP_HEADER_USER_AGENT,
+	HTTP_HEADER_ACCEPT,
+	HTTP_HEADER_ACCEPT_ENCODING,
+	HTTP_HEADER_ACCEPT_LANGUAGE,
+	HTTP_HEADER_COOKIE,
+	HTTP_HEADER_AUTHORIZATION,
+	HTTP_HEADER_REFERER,
+	HTTP_HEADER_ORIGIN,
+	HTTP_HEADER_IF_NONE_MATCH,
+	HTTP_HEADER_IF_MODIFIED_SINCE,
+	HTTP_HEADER_CACHE_CONTROL,
+	HTTP_HEADER_RANGE,
+	HTTP_HEADER_X_FORWARDED_FOR,
+	HTTP_HEADER_X_REAL_IP,
+	HTTP_HEADER_X_REQUEST_ID,
+
+	HTTP_HEADER_KNOWN_CNT,
+	HTTP_HEADER_UNKNOWN = HTTP_HEADER_KNOWN_CNT,
+};
+
+/*
+Map the name to the id by the perfect hash of its length, first and last chars, the name is
+compared only once. The name is case insensitive.
+Return Value:
+	HTTP_HEADER_UNKNOWN: It is not a well-known header
+*/
+HTTPHeaderId get_http_header_id(const StrView &name);
+StrView get_http_header_name(HTTPHeaderId id);
+
+}
+
+#endif
@@ -1,12 +1,21 @@
 #ifndef HTTP_SERVER_HPP_
 #define HTTP_SERVER_HPP_
+#include "base/server/http_headers.hpp"
 #include "base/server/task_server.hpp"
+#include "base/utils/str_view.hpp"
 #include <memory>
 #include <functional>
 #include <string>
 
 namespace cppbase {
 
+enum HTTPParserType {
+	/* The state machine of http-parser, the bytes are parsed as they come */
+	HTTP_PARSER_STATE_MACHINE,
+	/* The in-tree SIMD parser, the request head is parsed when all of it comes */
+	HTTP_PARSER_SIMD,
+};
+
 class HTTPRequestImpl;
 typedef std::shared_ptr<HTTPRequestImpl> HTTPRequestImplPtr;
 
@@ -17,14 +26,22 @@ class HTTPRequest {
 	HTTPRequest();
 
 	const std::string *get_uri(void);
-	const std::string *get_header(const std::string &header_name);
+	/* The value is copied once for each header, the later calls return the same string */
+	const std::string *get_header(const StrView &header_name);
+	const std::string *get_body(void);
 
-	const std::string *get_header(const char *header_name) {
-		std::string tmp = header_name;
-		return get_header(tmp);
-	}
+	/*
+	The views refer to the received bytes without copying, they are valid only in the
+	request callback. The header name is case insensitive, the view is empty if not found.
+	*/
+	StrView get_uri_view(void) const;
+	StrView get_header_view(const StrView &header_name) const;
+	StrView get_header_view(HTTPHeaderId id) const;
+	StrView get_body_view(void) const;
 
-	const std::string *get_body(void);
+	/* The user data of the current request, it is released when the request is done */
+	void set_context(const std::shared_ptr<void> &context);
+	const std::shared_ptr<void> &get_context(void) const;
  private:
 	friend class HTTPServerImpl;
 	HTTPRequestImplPtr impl_;
@@ -42,6 +59,14 @@ Return Value:
 	false: Close the connection
 */
 typedef std::function<bool (const HTTPRequest::HTTPRequestPtr &req, std::string &res) > HTTPRequestCallback;
+/*
+Param:
+	chunk: The piece of the body refers to the received bytes, it is valid only in the call
+Return Value:
+	true: Go on receiving the body
+	false: Close the connection
+*/
+typedef std::function<bool (const HTTPRequest::HTTPRequestPtr &req, const StrView &chunk) > HTTPBodyChunkCallback;
 class HTTPServer {
 public:
 	HTTPServer(uint32_t ip, uint16_t port);
@@ -52,10 +77,21 @@ public:
 	void start(void) throw (Errno);
 	
 	void set_request_callback(const HTTPRequestCallback &cb);
+	/*
+	Stream the request bodies instead of holding them, so the memory is bounded by the receive buffers.
+	on_headers is called when the head is parsed, the res is sent at once, i.e. "100 Continue".
+	Then on_body_chunk is called for each piece of the body, and on_complete at the end like the
+	request callback. The body views are empty in the request. It applies to the conns accepted later.
+	*/
+	void set_stream_callbacks(const HTTPRequestCallback &on_headers, const HTTPBodyChunkCallback &on_body_chunk,
+		const HTTPRequestCallback &on_complete);
+	/* It applies to the conns accepted later, HTTP_PARSER_STATE_MACHINE is the default */
+	void set_parser(HTTPParserType type);
 	void set_exit_callback(const ExitCallback &cb);
 	void set_signal_callback(const SignalCallback &cb);
 	void set_period_timer_callback(const PeriodTimerCallback &cb, void *data);
-	void add_oneshot_timer(const OneshotTimerCallback &cb, uint64_t nsecs, void *data) throw (Errno);
+	OneshotTimerId add_oneshot_timer(const OneshotTimerCallback &cb, uint64_t nsecs, void *data) throw (Errno);
+	bool cancel_oneshot_timer(OneshotTimerId id);
 	void add_signal(int signo);
 	void set_period_timer_interval(uint64_t period_ms);
 
@@ -1,29 +1,120 @@
 #ifndef HTTP_SERVER_IMPL_HPP_
 #define HTTP_SERVER_IMPL_HPP_
 
+#include <deque>
 #include <string>
-#include <unordered_map>
 #include <vector>
 #include <map>
 
 #include "base/server/task_server.hpp"
+#include "base/server/http_fast_parser.hpp"
 #include "base/server/http_server.hpp"
+#include "base/utils/str_view.hpp"
 #include "http-parser/http_parser.h"
 
 namespace cppbase {
 class HTTPRequestImpl {
 public:
+	enum {
+		/* The limit of the request head like http-parser */
+		HTTP_MAX_HEAD_BYTES = 80 * 1024,
+	};
+
 	HTTPRequestImpl();
+
+	void set_parser(HTTPParserType type)
+	{
+		parser_type_ = type;
+	}
+	/* The body is kept as pieces for the streaming callbacks, instead of the body view */
+	void set_streaming(bool streaming)
+	{
+		streaming_ = streaming;
+	}
 	/*
+	Parse the next request at the head of msg, the bytes parsed by the former calls are skipped.
+	Param:
+		iov: The scratch vector to peek the bytes
+		head: The scratch head for the SIMD parser, the headers are copied out of it
 	Return Value:
 		True: the http request is parsed completely;
 		False: The parsing needs more data;
 	Exception:
 		Meet some errors;
 	*/
-	bool parse_msg(uint8_t *data, uint32_t data_len) throw(std::string);
+	bool parse(PacketBuf &msg, std::vector<struct iovec> &iov, HTTPRequestHead &head) throw(std::string);
+	/*
+	Parse the bytes in place, the parsing stops at the end of one request.
+	The bytes must stay in the receive buffer until the request is handled, the parsed
+	tokens refer to them.
+	Param:
+		parsed: The count of parsed bytes, the left ones belong to the next request
+	Return Value:
+		True: the http request is parsed completely;
+		False: The parsing needs more data;
+	Exception:
+		Meet some errors;
+	*/
+	bool parse_msg(const uint8_t *data, uint32_t data_len, uint32_t &parsed) throw(std::string);
+	/* The bytes of the current request parsed by the former calls */
+	uint64_t parsed_bytes(void) const
+	{
+		return parsed_bytes_;
+	}
+
+	StrView get_uri_view(void) const
+	{
+		return uri_.view_;
+	}
+	StrView get_header_view(const StrView &header_name) const;
+	StrView get_header_view(HTTPHeaderId id) const
+	{
+		if (id >= HTTP_HEADER_KNOWN_CNT || known_headers_[id] == HTTP_HEADER_NONE) {
+			return StrView();
+		}
+		return headers_[known_headers_[id]].value_.view_;
+	}
+	StrView get_body_view(void) const
+	{
+		return body_.view_;
+	}
+
+	bool headers_done(void) const
+	{
+		return headers_done_;
+	}
+	/* Return true only for the first call of one request */
+	bool notify_headers(void)
+	{
+		bool first = !headers_notified_;
+
+		headers_notified_ = headers_done_;
+		return first && headers_done_;
+	}
+	/* The body pieces parsed by the last call, they are cleared by the caller after handling */
+	std::vector<StrView> &body_pieces(void)
+	{
+		return body_pieces_;
+	}
+	/*
+	Give up the parsed bytes, so they could be consumed before the request completes.
+	The head tokens are copied out of the bytes at the first call.
+	Return Value:
+		The bytes to consume at the head of the receive buffer
+	*/
+	uint64_t release_parsed(void);
+
+	void set_context(const std::shared_ptr<void> &context)
+	{
+		context_ = context;
+	}
+	const std::shared_ptr<void> &get_context(void) const
+	{
+		return context_;
+	}
+
 	const std::string * get_uri(void);
-	const std::string * get_http_header(const std::string &header_name);
+	const std::string * get_http_header(const StrView &header_name);
 	const std::string * get_body(void);
 	void clear();
 
@@ -35,23 +126,80 @@ private:
 	friend int on_headers_complete_cb(http_parser *parser);
 	friend int on_message_complete_cb(http_parser *parser);
 
-	std::vector<char> bytes_;
-	uint32_t unread_pos_;
-	uint32_t left_bytes_;
+	/*
+	The token refers to the received bytes. It is copied only when its pieces are
+	not contiguous, i.e. it spans the buffers or the body chunks.
+	*/
+	struct Token {
+		Token(): spill_(NULL) {
+		}
+		StrView view_;
+		std::string *spill_;
+	};
+	struct Header {
+		Token field_;
+		Token value_;
+	};
+
+	enum {
+		HTTP_HEADER_NONE = 0xffff,
+	};
 
+	void append_token(Token &token, const char *at, size_t length);
+	void append_body(const char *at, size_t length);
+	/* Record the index of the well-known header when its name is complete */
+	HTTPHeaderId index_header(uint32_t index);
+	/* Return the index in headers_, or HTTP_HEADER_NONE */
+	uint32_t find_header(const StrView &header_name) const;
+	bool parse_head(PacketBuf &msg, HTTPRequestHead &head) throw(std::string);
+	bool parse_body(PacketBuf &msg, std::vector<struct iovec> &iov) throw(std::string);
+
+	HTTPParserType parser_type_;
+	bool streaming_;
 	http_parser parser_;
 	http_parser_settings *setting_;
+	uint64_t parsed_bytes_;
 
-	std::string uri_;
-	std::string header_field_;
-	std::unordered_map<std::string, std::string> headers_;
-	std::string body_;
+	Token uri_;
+	std::vector<Header> headers_;
+	/* The index of the first header of each HTTPHeaderId in headers_ */
+	uint16_t known_headers_[HTTP_HEADER_KNOWN_CNT];
+	/* The value of the last header is being parsed, the next field is a new header */
+	bool in_value_;
+	Token body_;
+	/* The storage of the copied tokens, the deque never moves the strings */
+	std::deque<std::string> spills_;
 	bool is_completed_;
+	bool headers_done_;
+	bool headers_notified_;
+
+	/* For the streaming, the head is copied here when its bytes are consumed before the end */
+	std::vector<StrView> body_pieces_;
+	bool head_released_;
+	std::string head_copy_;
+	std::shared_ptr<void> context_;
+
+	/* The state of the SIMD parser, the head is scanned line by line for the empty one before parsing */
+	uint64_t head_scanned_;
+	uint64_t head_line_;
+	bool head_parsed_;
+	bool chunked_;
+	uint64_t body_left_;
+	HTTPChunkedDecoder chunked_decoder_;
+
+	/* Built from the views on demand for the string API */
+	std::string uri_str_;
+	std::string body_str_;
 };
 
 class HTTPServerImpl {
 public:
-	HTTPServerImpl(uint32_t ip, uint16_t port): server_(ip, port) {
+	enum {
+		/* The pipelined requests handled for one readiness, the left ones are handled in the next loop */
+		HTTP_PIPELINE_BUDGET = 64,
+	};
+
+	HTTPServerImpl(uint32_t ip, uint16_t port): server_(ip, port), parser_type_(HTTP_PARSER_STATE_MACHINE) {
 	}
 
 	bool init(void);
@@ -62,6 +210,19 @@ public:
 		req_cb_ = cb;
 	}
 
+	void set_stream_callbacks(const HTTPRequestCallback &on_headers, const HTTPBodyChunkCallback &on_body_chunk,
+		const HTTPRequestCallback &on_complete)
+	{
+		headers_cb_ = on_headers;
+		body_chunk_cb_ = on_body_chunk;
+		req_cb_ = on_complete;
+	}
+
+	void set_parser(HTTPParserType type)
+	{
+		parser_type_ = type;
+	}
+
 	void set_exit_callback(const ExitCallback &cb)
 	{
 		server_.set_exit_callback(cb);
@@ -77,9 +238,14 @@ public:
 		server_.set_period_timer_callback(cb, data);
 	}
 
-	void add_oneshot_timer(const OneshotTimerCallback &cb, uint64_t nsecs, void *data) throw (Errno)
+	OneshotTimerId add_oneshot_timer(const OneshotTimerCallback &cb, uint64_t nsecs, void *data) throw (Errno)
+	{
+		return server_.add_oneshot_timer(cb, nsecs, data);
+	}
+
+	bool cancel_oneshot_timer(OneshotTimerId id)
 	{
-		server_.add_oneshot_timer(cb, nsecs, data);
+		return server_.cancel_oneshot_timer(id);
 	}
 
 	void add_signal(int signo)
@@ -94,11 +260,25 @@ public:
 private:
 	void process_conn(const cppbase::ConnPtr &conn, cppbase::ConnEvent event);
 	void process_msg(const cppbase::ConnPtr &conn, cppbase::PacketBufPtr &msg);
+	/*
+	Deliver the head and the body pieces of the parsing request to the streaming callbacks.
+	Return Value:
+		false: The conn is closing, the left bytes are dropped
+	*/
+	bool stream_request(const ConnPtr &conn, const HTTPRequest::HTTPRequestPtr &request, PacketBufPtr &msg,
+		bool completed);
 
 	TCPServer server_;
 	std::map<ConnPtr, HTTPRequest::HTTPRequestPtr> conn_reqs_;
+	/* Reused by all requests, so the iovecs are not allocated per request */
+	std::vector<struct iovec> iov_;
+	HTTPParserType parser_type_;
+	/* Shared by all conns, the headers are copied into the request after parsing */
+	HTTPRequestHead head_;
 
 	HTTPRequestCallback req_cb_;
+	HTTPRequestCallback headers_cb_;
+	HTTPBodyChunkCallback body_chunk_cb_;
 };
 
 }  // namespace cppbase
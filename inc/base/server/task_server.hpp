@@ -1,17 +1,26 @@
 #ifndef TASK_SERVER_HPP_
 #define TASK_SERVER_HPP_
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 #include <functional>
 #include <string>
 #include <map>
 #include <set>
+#include <atomic>
+
+#include <pthread.h>
 
 #include "core/thread/thread.hpp"
+#include "core/thread/mpsc_queue.hpp"
+#include "core/thread/worker_pool.hpp"
 #include "core/net/socket.hpp"
 #include "core/event/event_poll.hpp"
+#include "core/event/uring_poll.hpp"
+#include "core/event/timer_wheel.hpp"
 #include "core/net/conn.hpp"
+#include "core/net/frame_codec.hpp"
 #include "base/utils/errno.hpp"
 #include "base/utils/sys_utils.hpp"
 #include "base/utils/networks_utils.hpp"
@@ -88,10 +97,29 @@ enum ConnEvent {
 	CONN_DISCONNECTED,
 };
 typedef std::function<void (const ConnPtr &conn, ConnEvent event) > ConnCallback;
+enum SendWatermark {
+	/* The pending send bytes exceed the high watermark, the conn is not read any more */
+	SEND_HIGH_WATERMARK,
+	/* The pending send bytes drop to the low watermark, the conn is read again */
+	SEND_LOW_WATERMARK,
+};
+typedef std::function<void (const ConnPtr &conn, SendWatermark mark) > WatermarkCallback;
 typedef std::function<void (const ConnPtr &conn, PacketBufPtr &msg) > MsgCallback;
+/* The frame is consumed after the callback returns, it doesn't outlive the callback */
+typedef std::function<void (const ConnPtr &conn, const Frame &frame) > FrameCallback;
+/*
+Run by the worker thread. Consume msg like MsgCallback, and append the response into reply
+instead of writing the conn, the conn is owned by the loop thread.
+Return Value:
+	true: Keep the connection
+	false: Close the connection after the reply is sent
+*/
+typedef std::function<bool (const ConnPtr &conn, PacketBufPtr &msg, PacketBuf &reply) > OffloadMsgCallback;
 typedef std::function<void (const int signum) > SignalCallback;
 typedef std::function<void (uint64_t expired_cnt, void *data) > PeriodTimerCallback;
-typedef std::function<void (void *data) > OneshotTimerCallback;
+typedef TimerCallback OneshotTimerCallback;
+typedef TimerWheel::TimerId OneshotTimerId;
+typedef std::function<void (void) > LoopTask;
 
 class UDPServer: public TaskServer {
 public:
@@ -114,18 +142,34 @@ private:
 
 class TCPServer: public TaskServer {
 public:
-	struct OneshotTimer {
-		OneshotTimer(uint64_t nsecs) {
-			timerfd_ = std::make_shared<SysTimerFd> (nsecs);
-		}
-		SysTimerFdPtr timerfd_;
-		OneshotTimerCallback cb_;
-		void *data_;
+	enum {
+		/* The loop wakes up at least once per second to check the exit callback */
+		LOOP_MAX_WAIT_NSECS = 1000000000,
+		TCP_DEFAULT_BACKLOG = SOMAXCONN,
+		/* The max conns accepted for one readiness of the listen socket */
+		TCP_DEFAULT_ACCEPT_BUDGET = 64,
+		/* The max posted tasks run in one loop, the left ones are run in the next loop */
+		LOOP_TASK_BUDGET = 1024,
+		/* The max bytes read from one conn for one readiness */
+		TCP_DEFAULT_READ_BUDGET = 256 * 1024,
 	};
-	typedef std::shared_ptr<OneshotTimer> OneshotTimerPtr;
 
+	enum IOBackend {
+		IO_BACKEND_EPOLL,
+		IO_BACKEND_URING,
+	};
 
-	TCPServer(uint32_t ip, uint16_t port): ip_(ip), port_(port), conn_cb_(NULL), msg_cb_(NULL) {
+	TCPServer(uint32_t ip, uint16_t port): ip_(ip), port_(port), conn_cb_(NULL), msg_cb_(NULL),
+		epoll_(EventPoll::EPOLL_HANDLER_MODE), edge_triggered_(false), io_backend_(IO_BACKEND_EPOLL),
+		accept_handler_(this, &TCPServer::accept_new_conn),
+		signal_handler_(this, &TCPServer::signal_ready),
+		timer_handler_(this, &TCPServer::timer_ready),
+		task_handler_(this, &TCPServer::task_ready),
+		recv_signal_(false), recv_timer_(false), recv_task_(false),
+		task_fd_(-1), task_wakeup_(false), loop_running_(false),
+		backlog_(TCP_DEFAULT_BACKLOG), accept_budget_(TCP_DEFAULT_ACCEPT_BUDGET), defer_accept_secs_(0),
+		idle_timeout_nsecs_(0), max_conns_(0), read_budget_(TCP_DEFAULT_READ_BUDGET), read_by_fionread_(false),
+		zerocopy_threshold_(0), send_high_watermark_(0), send_low_watermark_(0), conn_cnt_(0) {
 		sig_fd_ = -1;
 	}
 
@@ -137,6 +181,9 @@ public:
 		if (sig_fd_ != -1) {
 			close(sig_fd_);
 		}
+		if (task_fd_ != -1) {
+			close(task_fd_);
+		}
 	}
 
 	void set_conn_callback(const ConnCallback &cb) {
@@ -145,6 +192,20 @@ public:
 	void set_msg_callback(const MsgCallback &cb) {
 		msg_cb_ = cb;
 	}
+	/*
+	The received bytes are split into frames by the codec, every complete frame is delivered
+	to cb in place. It overrides the msg callback, the conn is closed on an invalid frame.
+	*/
+	void set_frame_callback(const FrameCodecPtr &codec, const FrameCallback &cb);
+	/*
+	The messages are handled by the workers instead of the loop thread, it overrides the msg callback.
+	The messages of one conn are handled by the same worker in order, and the replies are
+	sent by the loop in the same order. The pool could be shared by the servers.
+	*/
+	void set_offload_msg_callback(const OffloadMsgCallback &cb, const WorkerPoolPtr &pool) {
+		offload_msg_cb_ = cb;
+		worker_pool_ = pool;
+	}
 	void set_signal_callback(const SignalCallback &cb) {
 		sig_cb_ = cb;
 	}
@@ -152,7 +213,22 @@ public:
 		period_timer_cb_ = cb;
 		period_timer_data_ = data;
 	}
-	void add_oneshot_timer(const OneshotTimerCallback &cb, uint64_t nsecs, void *data) throw (Errno);
+	/*
+	The one-shot timers are kept in the timing wheel and driven by the loop timeout.
+	Return Value: The id to cancel the timer
+	*/
+	OneshotTimerId add_oneshot_timer(const OneshotTimerCallback &cb, uint64_t nsecs, void *data) throw (Errno);
+	/* Return false if the timer has expired or been cancelled */
+	bool cancel_oneshot_timer(OneshotTimerId id) {
+		return timer_wheel_.cancel_timer(id);
+	}
+	/*
+	The timers expiring in the same tick are run together, the default tick is 1ms.
+	Return false if there are pending timers.
+	*/
+	bool set_oneshot_timer_tick(uint64_t tick_nsecs) {
+		return timer_wheel_.set_tick_nsecs(tick_nsecs);
+	}
 	void add_signal(int signo) {
 		signals_.insert(signo);
 	}
@@ -165,17 +241,122 @@ public:
 		}
 	}
 
+	/* Must be set before init */
+	void set_listen_backlog(int backlog) {
+		backlog_ = backlog;
+	}
+	/*
+	Must be set before init.
+	The listen socket reports readiness only after the request data arrives,
+	the idle conn is accepted anyway after secs. 0 disables it.
+	*/
+	void set_defer_accept(uint32_t secs) {
+		defer_accept_secs_ = secs;
+	}
+	/* Accept at most budget conns for one readiness, the left ones are accepted in the next loop */
+	void set_accept_budget(uint32_t budget) {
+		accept_budget_ = budget ? budget : 1;
+	}
+
+	/*
+	Must be set before start, 0 disables it.
+	The conn without any read or write in timeout_ms is closed, the conn callback
+	gets CONN_DISCONNECTED for it.
+	*/
+	void set_idle_timeout(uint64_t timeout_ms) {
+		idle_timeout_nsecs_ = timeout_ms * 1000000;
+	}
+	/*
+	The conn is read until EAGAIN or budget bytes for one readiness, so one busy conn
+	doesn't starve the others. The left bytes are read in the next loop.
+	*/
+	void set_read_budget(uint32_t budget) {
+		read_budget_ = budget ? budget : 1;
+	}
+	/* Size every read by FIONREAD, it costs one more syscall but reads the bulk data at once */
+	void set_read_by_fionread(bool enable) {
+		read_by_fionread_ = enable;
+	}
+
+	/*
+	Send the slices not less than bytes by MSG_ZEROCOPY on the new conns, 0 disables it.
+	It only works with the epoll backend, the completions are reaped by EPOLLERR.
+	*/
+	void set_zerocopy_threshold(uint32_t bytes) {
+		zerocopy_threshold_ = bytes;
+	}
+
+	/*
+	The default send watermarks of the new conns, high 0 disables them. The conn callback
+	could change them for one conn by Conn::set_send_watermarks.
+	The conn is not read and its messages are not handled after the pending send bytes exceed
+	high, until they drop to low. So a slow peer doesn't make the server buffer without limit,
+	but the bytes written by one callback are never dropped.
+	*/
+	void set_send_watermarks(uint64_t high, uint64_t low) {
+		send_high_watermark_ = high;
+		send_low_watermark_ = std::min(low, high);
+	}
+	/* Notified when the conn stops and restarts reading by the watermarks */
+	void set_watermark_callback(const WatermarkCallback &cb) {
+		watermark_cb_ = cb;
+	}
+
+	/* 0 means unlimited. The new conns are closed at once when the limit is reached */
+	void set_max_conns(uint32_t max_conns) {
+		max_conns_ = max_conns;
+	}
+	uint32_t get_conn_cnt(void) const {
+		return conn_cnt_;
+	}
+
+	/*
+	Must be set before init.
+	The conns are registered with EPOLLET once, the server reads them until EAGAIN
+	and never toggles EPOLLOUT with epoll_ctl.
+	*/
+	void set_edge_triggered(bool enable) {
+		edge_triggered_ = enable;
+	}
+
+	/*
+	Must be set before init.
+	IO_BACKEND_URING accepts, receives and sends by io_uring, so one loop costs
+	one io_uring_enter. The server falls back to epoll when the kernel lacks the support,
+	get_io_backend tells the backend in use after init.
+	*/
+	void set_io_backend(IOBackend backend) {
+		io_backend_ = backend;
+	}
+	IOBackend get_io_backend(void) const {
+		return io_backend_;
+	}
+
+	/*
+	Thread safe. The task is run by the loop thread, in the posted order.
+	It could be called before start, the tasks are run after the loop starts.
+	*/
+	void post(const LoopTask &task);
+	void post(LoopTask &&task);
+	/* Thread safe. Run the task at once in the loop thread, otherwise post it */
+	void run_in_loop(const LoopTask &task);
+	bool in_loop_thread(void) const {
+		return loop_running_.load(std::memory_order_acquire) && pthread_equal(loop_thread_, pthread_self());
+	}
+
+	/*
+	Only in the loop thread. The bytes written and the close requested out of the server
+	callbacks, i.e. by the posted task, take effect after it.
+	*/
+	void update_conn(const ConnPtr &conn);
+
 	void close_conn(ConnPtr &conn)
 	{
-		if (!conn->send_buf_empty()) {
-			wait_write_conns_.erase(conn);
-		}
-		wait_read_conns_.erase(conn);
+		conn->ready_node().del();
 
+		// The conn stays in the write list until the left bytes are sent
 		if (conn->send_buf_empty() || conn->is_force_close()) {
-			epoll_.epoll_del_fd(conn->get_fd());
-			conns_.erase(conn->get_fd());
-			conn->close();
+			release_conn(conn);
 		} else {
 			conn->set_remote_fin();
 		}
@@ -184,34 +365,176 @@ public:
 	void start(void *data) throw (Errno);
 
 private:
+	/* The conn registers itself as the epoll handler */
+	class ServerConn: public Conn, public EventHandler {
+	public:
+		ServerConn(TCPServer *server, int fd): Conn(fd), server_(server), lru_node_(this), last_active_nsecs_(0),
+			frame_scanned_(0), wait_epollout_(false), read_paused_(false), uring_ops_(0), uring_sending_(false),
+			uring_recv_stopped_(false) {
+		}
+		void handle_events(uint32_t events)
+		{
+			server_->conn_handle_events(this, events);
+		}
+
+		enum {
+			URING_SEND_IOV_MAX = 64,
+			URING_FILE_CHUNK_BYTES = 64 * 1024,
+		};
+		/* The sendmsg must be valid until its completion arrives */
+		struct UringSendMsg {
+			struct msghdr msg_;
+			struct iovec iov_[URING_SEND_IOV_MAX];
+		};
+	private:
+		friend class TCPServer;
+
+		TCPServer *server_;
+		/* Linked in the server LRU list, the head is the least active one */
+		ListNode<ServerConn> lru_node_;
+		uint64_t last_active_nsecs_;
+		/* The bytes of the partial frame checked by the codec */
+		uint64_t frame_scanned_;
+		/* Only touched by the worker handling the conn, it keeps the partial message */
+		PacketBufPtr offload_msg_;
+		/* The socket buffer is full, the left bytes are sent by EPOLLOUT */
+		bool wait_epollout_;
+		/* Above the send high watermark, the conn is not read */
+		bool read_paused_;
+		/* The count of io_uring requests referring to the conn */
+		uint32_t uring_ops_;
+		bool uring_sending_;
+		/* The multishot recv is cancelled by the pause, it is submitted again at the resume */
+		bool uring_recv_stopped_;
+		std::unique_ptr<UringSendMsg> uring_send_msg_;
+		/* Hold itself after closed until all its io_uring requests complete */
+		ConnPtr uring_hold_;
+	};
+
+	enum UringOp {
+		URING_OP_ACCEPT = 1,
+		URING_OP_POLL,
+		URING_OP_RECV,
+		URING_OP_SEND,
+		URING_OP_CANCEL,
+
+		URING_OP_MASK = 7,
+	};
+
+	class FdHandler: public EventHandler {
+	public:
+		typedef void (TCPServer::*HandlerFunc)(void);
+
+		FdHandler(TCPServer *server, HandlerFunc func): server_(server), func_(func) {
+		}
+		void handle_events(uint32_t events)
+		{
+			(server_->*func_)();
+		}
+	private:
+		TCPServer *server_;
+		HandlerFunc func_;
+	};
+
+	uint32_t conn_epoll_flags(bool wait_write, bool read_paused = false) const;
+	bool init_uring(void);
 	void accept_new_conn(void);
-	void conn_read_data(int fd);
-	void conn_write_data(int fd);
+	void setup_new_conn(int fd, const struct sockaddr &addr, socklen_t addrlen);
+	void signal_ready(void);
+	void timer_ready(void);
+	void task_ready(void);
+	void process_tasks(void);
+	void wakeup_loop(void);
+	void conn_handle_events(ServerConn *conn, uint32_t events);
+	void conn_read_data(const ConnPtr &conn);
+	void conn_write_data(const ConnPtr &conn);
+	void conn_write_finished(const ConnPtr &conn);
+	void check_send_watermark(const ConnPtr &conn);
+	void resume_conn_read(const ConnPtr &conn);
+	uint32_t uring_dispatch(int64_t wait_nsecs);
+	void uring_flush_sends(void);
+	void uring_accept(const UringPoll::Completion &cqe);
+	void uring_recv(ServerConn *conn, const UringPoll::Completion &cqe);
+	void uring_send_done(ServerConn *conn, const UringPoll::Completion &cqe);
+	void uring_op_finished(ServerConn *conn);
+	void release_conn(const ConnPtr &conn);
+	void touch_conn(const ConnPtr &conn);
+	void sweep_idle_conns(void);
 	void process_msgs(void);
+	void process_frames(const ConnPtr &conn, PacketBufPtr &msg);
+	void offload_msgs(void);
+	void offload_msg_handle(const ConnPtr &conn, const PacketBufPtr &msg);
+	void offload_msg_done(const ConnPtr &conn, PacketBufPtr &reply, bool keep);
 	void create_signal_fd(void) throw (Errno);
 	void process_signals(void) throw (Errno);
 	void create_timer_fd(void) throw (Errno);
 	void process_timer(void) throw (Errno);
-	OneshotTimerPtr find_oneshot_timer(int fd) const;
-	void process_oneshot_timer(OneshotTimerPtr &timer);
+	int64_t next_loop_wait_nsecs(void) const;
+	void process_oneshot_timers(void);
 	void add_conn_wait_write(const ConnPtr &conn);
 	void remove_conn_wait_write(const ConnPtr &conn);
+	void flush_write_conns(void);
 	uint32_t ip_;
 	uint16_t port_;
 	ConnCallback conn_cb_;
 	MsgCallback msg_cb_;
+	FrameCodecPtr frame_codec_;
+	FrameCallback frame_cb_;
+	/* Reused by all frames, so the payload iovecs are not allocated per frame */
+	Frame frame_;
+	OffloadMsgCallback offload_msg_cb_;
+	WorkerPoolPtr worker_pool_;
 	SignalCallback sig_cb_;
 	PeriodTimerCallback period_timer_cb_;
 	std::set<int> signals_;
 	Socket lsock_;
 	EventPoll epoll_;
+	bool edge_triggered_;
+	IOBackend io_backend_;
+	UringPoll uring_;
+	std::vector<UringPoll::Completion> cqes_;
+	FdHandler accept_handler_;
+	FdHandler signal_handler_;
+	FdHandler timer_handler_;
+	FdHandler task_handler_;
+	bool recv_signal_;
+	bool recv_timer_;
+	bool recv_task_;
+	/* The eventfd wakes up the loop when the tasks are posted */
+	int task_fd_;
+	std::atomic<bool> task_wakeup_;
+	MPSCQueue<LoopTask> tasks_;
+	std::atomic<bool> loop_running_;
+	pthread_t loop_thread_;
+	int backlog_;
+	uint32_t accept_budget_;
+	uint32_t defer_accept_secs_;
+	uint64_t idle_timeout_nsecs_;
+	uint32_t max_conns_;
+	uint32_t read_budget_;
+	bool read_by_fionread_;
+	uint32_t zerocopy_threshold_;
+	uint64_t send_high_watermark_;
+	uint64_t send_low_watermark_;
+	WatermarkCallback watermark_cb_;
 	int sig_fd_;
 	SysTimerFdPtr period_timer_;
 	void *period_timer_data_;
-	std::map<int, ConnPtr> conns_;
-	std::set<ConnPtr> wait_read_conns_;
-	std::set<ConnPtr> wait_write_conns_;
-	std::map<int, OneshotTimerPtr> oneshot_timers_;
+	/* Indexed by fd, it owns the conns */
+	std::vector<ConnPtr> conns_;
+	uint32_t conn_cnt_;
+	/* The closed conns are released after the ready events are dispatched */
+	std::vector<ConnPtr> closed_conns_;
+	/* The conns with received data, linked by Conn::ready_node */
+	ListNode<Conn> ready_conns_;
+	/*
+	The conns waiting to send, linked by Conn::write_node.
+	With epoll they are flushed at the end of every loop, EPOLLOUT is only waited when the socket is full.
+	*/
+	ListNode<Conn> write_conns_;
+	/* The conns ordered by the last activity, only used with the idle timeout */
+	ListNode<ServerConn> lru_conns_;
+	TimerWheel timer_wheel_;
 };
 typedef std::shared_ptr<TCPServer> TCPServerPtr;
 } // namespace cppbase
@@ -0,0 +1,107 @@
+#ifndef LIST_HPP_
+#define LIST_HPP_
+
+#include <stddef.h>
+
+#include "base/utils/noncopyable.hpp"
+
+namespace cppbase {
+
+/*
+The kernel style circular doubly linked list. The node is embedded in its owner,
+so linking and unlinking are O(1) and need no allocation.
+The list head is a node without owner, an unlinked node points to itself.
+*/
+template <typename T>
+class ListNode: noncopyable {
+public:
+	ListNode(T *owner = NULL): prev_(this), next_(this), owner_(owner) {
+	}
+	~ListNode() {
+		del();
+	}
+
+	void set_owner(T *owner) {
+		owner_ = owner;
+	}
+	T *owner(void) const {
+		return owner_;
+	}
+
+	/* For the head, it means no entry. For the node, it means unlinked */
+	bool empty(void) const {
+		return next_ == this;
+	}
+	bool linked(void) const {
+		return next_ != this;
+	}
+
+	ListNode *next(void) const {
+		return next_;
+	}
+	ListNode *prev(void) const {
+		return prev_;
+	}
+
+	/* Insert the node after the head */
+	void add(ListNode *head) {
+		insert(head, head->next_);
+	}
+	/* Insert the node before the head, it is the tail of the list */
+	void add_tail(ListNode *head) {
+		insert(head->prev_, head);
+	}
+	/* Unlink the node and reinit it, it is safe to delete an unlinked node */
+	void del(void) {
+		prev_->next_ = next_;
+		next_->prev_ = prev_;
+		prev_ = next_ = this;
+	}
+	void move_tail(ListNode *head) {
+		del();
+		add_tail(head);
+	}
+
+	/* Move all entries of this list to the tail of the head, this list becomes empty */
+	void splice_tail(ListNode *head) {
+		if (empty()) {
+			return;
+		}
+		ListNode *first = next_;
+		ListNode *last = prev_;
+		ListNode *at = head->prev_;
+
+		first->prev_ = at;
+		at->next_ = first;
+		last->next_ = head;
+		head->prev_ = last;
+
+		prev_ = next_ = this;
+	}
+
+	/* Only for the head */
+	T *first_owner(void) const {
+		return empty() ? NULL : next_->owner_;
+	}
+private:
+	void insert(ListNode *prev, ListNode *next) {
+		next->prev_ = this;
+		next_ = next;
+		prev_ = prev;
+		prev->next_ = this;
+	}
+
+	ListNode *prev_;
+	ListNode *next_;
+	T *owner_;
+};
+
+/*
+Iterate the list, it is safe to unlink the current entry in the loop body.
+*/
+#define list_for_each_safe(pos, n, head) \
+	for (pos = (head)->next(), n = pos->next(); pos != (head); pos = n, n = pos->next())
+
+}
+
+#endif
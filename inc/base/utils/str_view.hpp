@@ -0,0 +1,65 @@
+#ifndef STR_VIEW_HPP_
+#define STR_VIEW_HPP_
+
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+#include <string>
+
+namespace cppbase {
+
+/*
+The reference to the bytes owned by others, like std::string_view of C++17.
+It is valid only while the owner keeps the bytes.
+*/
+class StrView {
+public:
+	StrView(): data_(NULL), size_(0) {
+	}
+	StrView(const char *data, size_t size): data_(data), size_(size) {
+	}
+	StrView(const char *str): data_(str), size_(strlen(str)) {
+	}
+	StrView(const std::string &str): data_(str.data()), size_(str.size()) {
+	}
+
+	const char *data(void) const
+	{
+		return data_;
+	}
+	size_t size(void) const
+	{
+		return size_;
+	}
+	bool empty(void) const
+	{
+		return size_ == 0;
+	}
+	std::string to_string(void) const
+	{
+		return std::string(data_, size_);
+	}
+
+	bool operator==(const StrView &other) const
+	{
+		return size_ == other.size_ && (size_ == 0 || memcmp(data_, other.data_, size_) == 0);
+	}
+	bool operator!=(const StrView &other) const
+	{
+		return !(*this == other);
+	}
+	/* Compare ignoring the case of ASCII letters, i.e. for HTTP header names */
+	bool equal_nocase(const StrView &other) const
+	{
+		return size_ == other.size_ && (size_ == 0 || strncasecmp(data_, other.data_, size_) == 0);
+	}
+
+private:
+	const char *data_;
+	size_t size_;
+};
+
+}
+
+#endif
@@ -70,7 +70,7 @@ public:
 	{
 	}
 	void start(void) throw (Errno);
-	SysTimerFd() {
+	~SysTimerFd() {
 		if (fd_ != -1) {
 			close(fd_);
 		}
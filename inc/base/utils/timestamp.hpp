@@ -1,6 +1,7 @@
 #ifndef TIMESTAMP_HPP_
 #define TIMESTAMP_HPP_
 #include <time.h>
+#include <stdint.h>
 
 namespace cppbase {
 class TimeStamp {
@@ -8,6 +9,14 @@ public:
 	static unsigned int get_cur_secs(void) {
 		return time(NULL);
 	}
+
+	/* It is not affected by the system time changes, used for the deadlines */
+	static uint64_t get_monotonic_nsecs(void) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+	}
 };
 }
 
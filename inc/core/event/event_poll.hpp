@@ -7,21 +7,48 @@
 #include <vector>
 #include <utility>
 
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE	(1U << 28)
+#endif
+
 namespace cppbase {
 
+/*
+The object registered by EventPoll::epoll_add_handler. Its address is stored in
+epoll_event.data.ptr, so one ready event is dispatched to it without any lookup.
+*/
+class EventHandler {
+public:
+	virtual ~EventHandler() {}
+	virtual void handle_events(uint32_t events) = 0;
+};
+
 class EventPoll {
 public:
 	struct EPEvent {
 		EPEvent() {}
 
-		EPEvent(int fd, uint32_t events): fd_(fd), events_(events) {
+		EPEvent(int fd, uint32_t events): fd_(fd), events_(events), handler_(NULL) {
+		}
+
+		EPEvent(EventHandler *handler, uint32_t events): fd_(-1), events_(events), handler_(handler) {
 		}
 	
 		int fd_;
 		uint32_t events_;
+		EventHandler *handler_;
+	};
+
+	/*
+	EPOLL_FD_MODE: epoll_event.data carries the fd, use epoll_add_fd/epoll_modify_fd
+	EPOLL_HANDLER_MODE: epoll_event.data carries the EventHandler, use epoll_add_handler/epoll_modify_handler
+	*/
+	enum EPMode {
+		EPOLL_FD_MODE,
+		EPOLL_HANDLER_MODE,
 	};
 
-	EventPoll(): epoll_fd_(-1), mon_fd_cnts_(0) {
+	EventPoll(EPMode mode = EPOLL_FD_MODE): epoll_fd_(-1), mode_(mode), mon_fd_cnts_(0) {
 	}
 	~EventPoll() {
 		if (-1 != epoll_fd_) {
@@ -29,26 +56,60 @@ public:
 		}
 	}
 
-	enum {
+	enum : uint32_t {
 		EPOLL_EPOLLIN = EPOLLIN,
 		EPOLL_EPOLLOUT = EPOLLOUT,
 		EPOLL_EPOLLRDHUP = EPOLLRDHUP,
 
 		EPOLL_ALL_FLAGS = (EPOLL_EPOLLIN|EPOLL_EPOLLOUT|EPOLL_EPOLLRDHUP),
+
+		/* Modifiers, they must be combined with at least one flag above */
+		EPOLL_EPOLLET = EPOLLET,
+		EPOLL_EPOLLONESHOT = EPOLLONESHOT,
+		EPOLL_EPOLLEXCLUSIVE = EPOLLEXCLUSIVE,
+
+		EPOLL_ALL_MODIFIERS = (EPOLL_EPOLLET|EPOLL_EPOLLONESHOT|EPOLL_EPOLLEXCLUSIVE),
 	};
 	
 	bool init(void);
+	EPMode get_mode(void) const
+	{
+		return mode_;
+	}
+	int get_fd(void) const
+	{
+		return epoll_fd_;
+	}
+
 	bool epoll_add_fd(int fd, unsigned int flags);
 	bool epoll_modify_fd(int fd, unsigned int flags);
+	bool epoll_add_handler(int fd, EventHandler *handler, uint32_t flags);
+	/* Also used to rearm the EPOLL_EPOLLONESHOT handler */
+	bool epoll_modify_handler(int fd, EventHandler *handler, uint32_t flags);
 	void epoll_del_fd(int fd);
 	uint32_t epoll_wait(std::vector<EPEvent> &ready_fds, int wait_secs);
 	uint32_t epoll_wait(std::vector<EPEvent> &ready_fds);
+	/*
+	Wait at most wait_nsecs, the negative value means infinite.
+	It uses epoll_pwait2 when the kernel supports, otherwise the timeout is rounded up to msecs.
+	*/
+	uint32_t epoll_wait_ns(std::vector<EPEvent> &ready_fds, int64_t wait_nsecs);
+	/*
+	Only for EPOLL_HANDLER_MODE. Wait at most wait_msecs (-1 means infinite)
+	and invoke the handler of every ready event.
+	Return Value: The count of ready events
+	*/
+	uint32_t epoll_dispatch(int wait_msecs);
+	uint32_t epoll_dispatch_ns(int64_t wait_nsecs);
 	
 private:
-	bool flags_sanity_check(uint32_t flags);
+	bool flags_sanity_check(uint32_t flags, bool add);
 	void convert_epoll_flags(struct epoll_event &event, int fd, uint32_t flags);
+	bool epoll_ctl_event(int op, int fd, struct epoll_event &event);
+	int wait_ready_events(int64_t wait_nsecs);
 
 	int epoll_fd_;
+	EPMode mode_;
 	enum {
 		EPOOL_EVENT_MAX_WASTE_CNT = 48,
 	};
@@ -59,4 +120,3 @@ private:
 }
 
 #endif
-
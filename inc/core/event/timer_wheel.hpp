@@ -0,0 +1,117 @@
+#ifndef TIMER_WHEEL_HPP_
+#define TIMER_WHEEL_HPP_
+
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "base/utils/list.hpp"
+#include "base/utils/noncopyable.hpp"
+
+namespace cppbase {
+
+typedef std::function<void (void *data) > TimerCallback;
+
+/*
+The hierarchical timing wheel, it has TIMER_WHEEL_LEVELS levels and every level has
+TIMER_WHEEL_SLOTS slots. The slot of level N covers SLOTS^N ticks, the timers are
+moved to the lower level when the wheel turns to them.
+
+The timers expiring in the same tick are coalesced, they are run by one run_timers.
+It never creates any fd, the owner drives it by the loop timeout, i.e. waits
+next_timeout_nsecs and calls run_timers.
+
+Adding and cancelling are O(1), the timer nodes are reused, so they don't allocate
+memory in the steady state.
+*/
+class TimerWheel: noncopyable {
+public:
+	/* The generation is in the high 32 bits, so a stale id never cancels the reused node */
+	typedef uint64_t TimerId;
+
+	enum {
+		INVALID_TIMER_ID = 0,
+	};
+
+	enum {
+		TIMER_WHEEL_LEVEL_BITS = 6,
+		TIMER_WHEEL_SLOTS = 1 << TIMER_WHEEL_LEVEL_BITS,
+		TIMER_WHEEL_SLOT_MASK = TIMER_WHEEL_SLOTS - 1,
+		TIMER_WHEEL_LEVELS = 4,
+		/* The longer timer is clamped to it, and it is moved down until expires */
+		TIMER_WHEEL_MAX_TICKS = (1 << (TIMER_WHEEL_LEVEL_BITS * TIMER_WHEEL_LEVELS)) - 1,
+	};
+
+	static const uint64_t DEFAULT_TICK_NSECS = 1000000;
+
+	TimerWheel(uint64_t tick_nsecs = DEFAULT_TICK_NSECS);
+
+	/* Return false when there are pending timers */
+	bool set_tick_nsecs(uint64_t tick_nsecs);
+	uint64_t get_tick_nsecs(void) const {
+		return tick_nsecs_;
+	}
+
+	/*
+	The timer expires after delay_nsecs from now_nsecs, it is rounded up to the tick.
+	Return Value: The id to cancel the timer
+	*/
+	TimerId add_timer(const TimerCallback &cb, uint64_t delay_nsecs, void *data, uint64_t now_nsecs);
+	/* Return false if the timer has expired or been cancelled */
+	bool cancel_timer(TimerId id);
+
+	/*
+	Run all the timers expiring before now_nsecs, the callback may add or cancel timers.
+	Return Value: The count of run timers
+	*/
+	uint32_t run_timers(uint64_t now_nsecs);
+
+	/*
+	Return Value: The nsecs till the wheel must be driven again, -1 means no timer.
+	It may be earlier than the nearest timer when the higher level needs to be moved down.
+	*/
+	int64_t next_timeout_nsecs(uint64_t now_nsecs) const;
+
+	uint32_t size(void) const {
+		return pending_cnt_;
+	}
+
+private:
+	struct TimerNode {
+		TimerNode(): index_(0), gen_(1), expire_tick_(0), level_(0), slot_(0), data_(NULL) {
+			link_.set_owner(this);
+		}
+		ListNode<TimerNode> link_;
+		uint32_t index_;
+		uint32_t gen_;
+		uint64_t expire_tick_;
+		uint8_t level_;
+		uint8_t slot_;
+		TimerCallback cb_;
+		void *data_;
+	};
+	typedef ListNode<TimerNode> TimerList;
+
+	void enqueue(TimerNode *node);
+	void dequeue(TimerNode *node);
+	void cascade(uint32_t level);
+	void free_node(TimerNode *node);
+
+	uint64_t tick_nsecs_;
+	/* The next tick to be run */
+	uint64_t cur_tick_;
+	bool started_;
+	uint32_t pending_cnt_;
+	TimerList wheel_[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	/* The bit is set when the slot is not empty */
+	uint64_t slot_bitmap_[TIMER_WHEEL_LEVELS];
+	/* The deque doesn't move the nodes when growing, the lists refer to them */
+	std::deque<TimerNode> nodes_;
+	std::vector<uint32_t> free_nodes_;
+};
+
+}
+
+#endif
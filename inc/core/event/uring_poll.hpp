@@ -0,0 +1,124 @@
+#ifndef URING_POLL_HPP_
+#define URING_POLL_HPP_
+
+#include <sys/socket.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "base/utils/noncopyable.hpp"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+namespace cppbase {
+
+/*
+The io_uring reactor, it is driven by the raw syscalls and needs no liburing.
+The receive path uses the provided buffer ring, so the multishot recv picks one
+buffer by itself and the caller must recycle it after consuming the bytes.
+
+All the prep_* functions only fill the SQE, the SQEs are submitted by the next
+submit_and_wait together with waiting the completions, so one loop costs one
+io_uring_enter.
+*/
+class UringPoll: noncopyable {
+public:
+	struct Completion {
+		Completion() {}
+		Completion(uint64_t user_data, int32_t res, uint32_t flags)
+			: user_data_(user_data), res_(res), flags_(flags) {
+		}
+
+		/* The multishot request is still alive */
+		bool more(void) const;
+		/* The recv picks one buffer from the ring */
+		bool has_buffer(void) const;
+		uint16_t buffer_id(void) const;
+
+		uint64_t user_data_;
+		int32_t res_;
+		uint32_t flags_;
+	};
+
+	enum {
+		URING_DEFAULT_ENTRIES = 256,
+		URING_DEFAULT_BUF_CNT = 256,
+		URING_DEFAULT_BUF_SIZE = 4096,
+	};
+
+	UringPoll();
+	~UringPoll();
+
+	/* Check if the kernel supports all features UringPoll depends on */
+	static bool supported(void);
+
+	/*
+	buf_cnt must be power of 2.
+	Return false if the kernel lacks the support, the caller should fall back to epoll.
+	*/
+	bool init(uint32_t entries = URING_DEFAULT_ENTRIES, uint32_t buf_cnt = URING_DEFAULT_BUF_CNT,
+		uint32_t buf_size = URING_DEFAULT_BUF_SIZE);
+
+	bool prep_accept_multishot(int fd, uint32_t flags, uint64_t user_data);
+	bool prep_recv_multishot(int fd, uint64_t user_data);
+	/* The msg and its iovecs must be valid until the completion arrives */
+	bool prep_sendmsg(int fd, const struct msghdr *msg, uint32_t flags, uint64_t user_data);
+	bool prep_poll_multishot(int fd, uint32_t events, uint64_t user_data);
+	bool prep_cancel(uint64_t target_user_data, uint64_t user_data);
+
+	/*
+	Submit the pending SQEs and wait at most wait_nsecs (negative means infinite) for the completions.
+	Return Value: The count of completions
+	*/
+	uint32_t submit_and_wait(std::vector<Completion> &cqes, int64_t wait_nsecs);
+
+	uint8_t *get_buffer(uint16_t bid) const
+	{
+		return bufs_ + static_cast<size_t>(bid) * buf_size_;
+	}
+	/* Return the buffer picked by recv back to the ring */
+	void recycle_buffer(uint16_t bid);
+
+private:
+	struct io_uring_sqe *get_sqe(void);
+	int enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags, void *arg, size_t argsz);
+	bool setup_rings(uint32_t entries);
+	bool setup_buf_ring(uint32_t buf_cnt, uint32_t buf_size);
+	void release(void);
+
+	int ring_fd_;
+
+	/* submission queue */
+	void *sq_ptr_;
+	size_t sq_len_;
+	uint32_t *sq_head_;
+	uint32_t *sq_tail_;
+	uint32_t sq_mask_;
+	uint32_t *sq_array_;
+	struct io_uring_sqe *sqes_;
+	size_t sqes_len_;
+	uint32_t sqe_tail_;
+	uint32_t to_submit_;
+
+	/* completion queue */
+	void *cq_ptr_;
+	size_t cq_len_;
+	uint32_t *cq_head_;
+	uint32_t *cq_tail_;
+	uint32_t cq_mask_;
+	struct io_uring_cqe *cqes_;
+
+	/* provided buffer ring */
+	struct io_uring_buf_ring *buf_ring_;
+	size_t buf_ring_len_;
+	uint32_t buf_cnt_;
+	uint32_t buf_size_;
+	uint8_t *bufs_;
+	uint16_t buf_tail_;
+};
+
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef BUFFER_POOL_HPP_
+#define BUFFER_POOL_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <vector>
+
+#include "base/utils/noncopyable.hpp"
+
+namespace cppbase {
+
+/*
+The per-thread cache of the buffer memory with several size classes. The memory is
+not zero filled and it is cached when released, so the conn churn doesn't hit malloc.
+The memory may be released by another thread, it is cached by that thread then.
+
+With the hugepage slabs, the memory is carved from 2MB slabs backed by the huge pages.
+The slabs are never returned to the system. The slab chunks beyond the cache of the
+thread are spilled to the shared list, where all threads take them before carving.
+*/
+class BufferPool: noncopyable {
+public:
+	enum SizeClass {
+		BUF_CLASS_1K,
+		BUF_CLASS_4K,
+		BUF_CLASS_16K,
+		BUF_CLASS_64K,
+		BUF_CLASS_CNT,
+	};
+
+	enum {
+		BUF_POOL_SLAB_BYTES = 2 * 1024 * 1024,
+		/* The cached bytes of one class, the more malloc chunks are freed */
+		BUF_POOL_CACHE_BYTES = 4 * 1024 * 1024,
+	};
+
+	struct Chunk {
+		Chunk(): data_(NULL), cls_(BUF_CLASS_1K), slab_(false) {
+		}
+		uint8_t *data_;
+		SizeClass cls_;
+		bool slab_;
+	};
+
+	/* The smallest class not less than size, the largest one for the bigger size */
+	static SizeClass size_class(uint32_t size);
+	static uint32_t class_bytes(SizeClass cls)
+	{
+		return 1024U << (cls * 2);
+	}
+
+	/* Get the chunk from the pool of the current thread */
+	static Chunk get(SizeClass cls);
+	/* Return the chunk to the pool of the current thread */
+	static void put(const Chunk &chunk);
+
+	/* It takes effect for the slabs carved later by all threads */
+	static void set_hugepage_slabs(bool enable)
+	{
+		hugepage_slabs_.store(enable, std::memory_order_relaxed);
+	}
+
+	/* The cached bytes of the current thread */
+	static size_t cached_bytes(void);
+	/* The bytes of the slabs carved by all threads */
+	static size_t slab_bytes(void)
+	{
+		return slab_bytes_.load(std::memory_order_relaxed);
+	}
+
+private:
+	friend class BufferPoolHolder;
+
+	BufferPool();
+	~BufferPool();
+
+	/* Return NULL after the thread pool is destroyed at the thread exit */
+	static BufferPool *local(void);
+	bool carve_slab(SizeClass cls);
+	/* Take the spilled slab chunks of other threads, return false if there is none */
+	bool refill_shared(SizeClass cls);
+	static void spill_shared(const Chunk &chunk);
+
+	std::vector<Chunk> free_chunks_[BUF_CLASS_CNT];
+	size_t cached_bytes_[BUF_CLASS_CNT];
+
+	static std::atomic<bool> hugepage_slabs_;
+	static std::atomic<size_t> slab_bytes_;
+};
+
+}
+
+#endif
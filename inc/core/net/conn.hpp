@@ -6,12 +6,16 @@
 #include <string.h>
 #include <stdio.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 #include <deque>
+#include <string>
 
 #include "base/utils/compiler.hpp"
+#include "base/utils/list.hpp"
 
 namespace cppbase {
 
@@ -62,19 +66,172 @@ private:
 	char str[48];
 };
 
+/*
+The refcounted immutable bytes. The holder keeps the memory alive until all the
+buffers referring to it are released, so one payload could be queued on many
+conns without copying.
+*/
+class SharedSlice {
+public:
+	SharedSlice(): data_(NULL), size_(0) {
+	}
+	SharedSlice(const std::shared_ptr<const void> &holder, const void *data, uint32_t size)
+		: holder_(holder), data_(static_cast<const uint8_t*>(data)), size_(size) {
+	}
+	/* Take over the bytes of the string or vector */
+	explicit SharedSlice(std::string &&data);
+	explicit SharedSlice(std::vector<uint8_t> &&data);
+
+	/* The sub slice shares the holder */
+	SharedSlice slice(uint32_t offset, uint32_t size) const;
+
+	const uint8_t *data(void) const
+	{
+		return data_;
+	}
+	uint32_t size(void) const
+	{
+		return size_;
+	}
+	bool empty(void) const
+	{
+		return (size_ == 0);
+	}
+	const std::shared_ptr<const void> &holder(void) const
+	{
+		return holder_;
+	}
+
+private:
+	std::shared_ptr<const void> holder_;
+	const uint8_t *data_;
+	uint32_t size_;
+};
+
+/*
+The range of a file sent by sendfile, the bytes never enter the user space.
+The holder owns the fd, it is closed when the last slice referring to it is released.
+*/
+class FileSlice {
+public:
+	FileSlice(): fd_(-1), offset_(0), size_(0) {
+	}
+	FileSlice(const std::shared_ptr<const void> &holder, int fd, off_t offset, uint64_t size)
+		: holder_(holder), fd_(fd), offset_(offset), size_(size) {
+	}
+	/* Take over the fd, it is closed with the last slice */
+	static FileSlice from_fd(int fd, off_t offset, uint64_t size);
+
+	/* The sub slice shares the holder */
+	FileSlice slice(uint64_t offset, uint64_t size) const;
+
+	int fd(void) const
+	{
+		return fd_;
+	}
+	off_t offset(void) const
+	{
+		return offset_;
+	}
+	uint64_t size(void) const
+	{
+		return size_;
+	}
+	const std::shared_ptr<const void> &holder(void) const
+	{
+		return holder_;
+	}
+
+private:
+	std::shared_ptr<const void> holder_;
+	int fd_;
+	off_t offset_;
+	uint64_t size_;
+};
+
 class Buffer;
 typedef std::shared_ptr<Buffer> BufferPtr;
 
 class PacketBuf {
 public:
+	enum {
+		/* The smaller slice is copied, a buffer node costs more than the bytes */
+		PACKET_BUF_COPY_MAX_BYTES = 512,
+		/* The larger file range is split into several buffers */
+		PACKET_BUF_FILE_MAX_BYTES = 1 << 30,
+	};
+
+	/* No buffer is allocated until the bytes come */
 	PacketBuf(): avail_write_buf_(0), total_bytes_(0) {
-		alloc_new_buf();
 	}
 
-	void get_left_space(uint8_t **start, uint32_t *size);
+	/* The new buffer is allocated by the size class fitting size_hint if the tail is full */
+	void get_left_space(uint8_t **start, uint32_t *size, uint32_t size_hint = 0);
+	/*
+	Fill the iovecs with the free space from the tail, the new buffers are allocated
+	until the space reaches size or the iovecs are used up.
+	Return Value: The count of filled iovecs
+	*/
+	uint32_t get_left_space_iov(struct iovec *iov, uint32_t iov_cnt, uint32_t size);
+	/*
+	The file range has no memory, start is NULL for it.
+	It only appears in the send buffer which is sent by Conn.
+	*/
 	void peek_cur_data(uint8_t **start, uint32_t *size);
+	/* The bytes may span the buffers reserved by get_left_space_iov */
 	void append_bytes(uint32_t bytes);
 	void consume_bytes(uint32_t bytes);
+	/* Copy the data into the tail of buffers */
+	void append_data(const void *data, uint32_t data_len);
+	/* Append the slice by reference without copying, it is never written by the PacketBuf */
+	void append_slice(const SharedSlice &slice);
+	/* Move all the buffers of other to the tail without copying, other becomes empty */
+	void append_packet(PacketBuf &other);
+	/* Append the file range, it is sent by sendfile in order with the other bytes */
+	void append_file(const FileSlice &file);
+	/* Return true if the head is a file range, the range is returned */
+	bool peek_file(int *fd, off_t *offset, uint32_t *size);
+	/*
+	Read at most max_bytes of the head file range into memory by pread, for the sender
+	which could not sendfile, i.e. io_uring.
+	Return false if fails to read the file
+	*/
+	bool read_front_file(uint32_t max_bytes);
+	/*
+	Fill the iovecs with the readable data from the head, it stops at the file range.
+	Return Value: The count of filled iovecs
+	*/
+	uint32_t peek_data_iov(struct iovec *iov, uint32_t iov_cnt);
+	/*
+	Make the first bytes of data contiguous, so the parser could see the whole header
+	in place. Only the missing bytes are copied if the head buffer has enough room,
+	otherwise the bytes are moved into one new buffer.
+	Return Value: The start of the bytes, NULL if there are not enough bytes before
+	the end or the file range.
+	*/
+	uint8_t *linearize(uint32_t bytes);
+	/*
+	Append the iovecs of size bytes from offset into iov, the bytes are not copied.
+	It stops at the end of data or the file range.
+	Return Value: The bytes covered by the appended iovecs
+	*/
+	uint64_t peek_range_iov(uint64_t offset, uint64_t size, std::vector<struct iovec> &iov) const;
+	/*
+	Search the pattern from offset by memchr, the pattern may span the buffers.
+	Return Value: The offset of the pattern, -1 if not found
+	*/
+	int64_t find_bytes(const void *pattern, uint32_t size, uint64_t offset = 0) const;
+	/*
+	Read one byte in place, it never copies or allocates.
+	Return Value: The byte at offset, -1 if it is beyond the data or in the file range
+	*/
+	int byte_at(uint64_t offset) const;
+	/*
+	Like peek_data_iov but only the slices at the head, their holders are returned
+	to keep the bytes alive, i.e. for MSG_ZEROCOPY.
+	Return Value: The count of filled iovecs
+	*/
+	uint32_t peek_slice_iov(struct iovec *iov, uint32_t iov_cnt, std::vector<std::shared_ptr<const void> > &holders);
 
 	uint64_t total_size() const
 	{
@@ -85,6 +242,18 @@ public:
 	{
 		return (total_bytes_ == 0);
 	}
+
+	/* The count of the held buffers, it is 0 for the idle one */
+	uint32_t buf_cnt() const
+	{
+		return bufs_.size();
+	}
+
+	/*
+	Return the empty buffers after the tail to the pool, i.e. the ones reserved by
+	get_left_space_iov but not filled. All buffers are returned if it is empty.
+	*/
+	void release_spare_bufs(void);
 		
 private:
 	void append_new_buf(BufferPtr &buf)
@@ -92,30 +261,44 @@ private:
 		bufs_.push_back(buf);
 	}
 
-	void remove_front_buf(void)
+	void release_all_bufs(void)
 	{
-		bufs_.pop_front();
-		if (avail_write_buf_) {
-			avail_write_buf_--;
-		}
+		bufs_.clear();
+		avail_write_buf_ = 0;
 	}
 
-	void alloc_new_buf(void);
-
-	std::deque<BufferPtr> bufs_;
+	/* The buffer memory is got from the thread buffer pool */
+	void alloc_new_buf(uint32_t size_hint = 0);
+	/* Compare the pattern with the bytes from pos of the buffer idx and the following ones */
+	bool match_bytes(uint32_t idx, uint32_t pos, const uint8_t *pattern, uint32_t size) const;
+	/* Copy the bytes from the buffers after the head into dst and remove the drained ones */
+	void pull_bytes(uint32_t first, uint8_t *dst, uint32_t bytes);
+	/* Insert the buffer holding bytes after the written ones, it becomes the write buffer */
+	void insert_buf(const BufferPtr &buf, uint32_t bytes);
+
+	/* The vector allocates nothing when it is empty, it is cheaper than deque for the idle conns */
+	std::vector<BufferPtr> bufs_;
 	uint32_t avail_write_buf_;
 	uint64_t total_bytes_;
 };
 typedef std::shared_ptr<PacketBuf> PacketBufPtr;
 
-class Conn {
+class Conn: public std::enable_shared_from_this<Conn> {
 public: 
-	Conn(int fd): fd_(fd), force_close_(false), local_fin_(false), remote_fin_(false) {
+	enum {
+		CONN_DEFAULT_READ_BYTES = 16 * 1024,
+		CONN_READ_IOV_MAX = 64,
+		CONN_SEND_IOV_MAX = 64,
+	};
+
+	Conn(int fd): fd_(fd), force_close_(false), local_fin_(false), remote_fin_(false),
+		send_high_watermark_(0), send_low_watermark_(0),
+		zerocopy_threshold_(0), zerocopy_seq_(0), ready_node_(this), write_node_(this) {
 		rcv_buf_ = std::make_shared<PacketBuf>();
 		send_buf_ = std::make_shared<PacketBuf>();
 	}
 	
-	~Conn () {
+	virtual ~Conn () {
 		close();
 	}
 
@@ -123,6 +306,9 @@ public:
 	{
 		if (fd_ != -1) {
 			// LOG_DEBUG << to_str() << " is closed" << std::endl;
+			if (!zerocopy_sends_.empty()) {
+				abort_zerocopy();
+			}
 			::close(fd_);
 			fd_ = -1;
 			local_fin_ = true;
@@ -165,9 +351,34 @@ public:
 		remote_fin_ = true;
 	}
 
-	bool read_bytes(void);
+	/*
+	Read at most size bytes by one readv into the chained buffers.
+	The unfilled buffers are kept for the next read, the caller releases them by
+	PacketBuf::release_spare_bufs after the reads. They are released on failure.
+	Return Value:
+		>0: The bytes read into the receive buffer
+		0: The conn is closed by peer
+		-1: Fail to read, errno is set. EAGAIN/EWOULDBLOCK means no more data
+	*/
+	ssize_t read_bytes(uint32_t size = CONN_DEFAULT_READ_BYTES);
+	/* The bytes could be read at once by FIONREAD, -1 means failure */
+	int get_readable_bytes(void) const;
 	void write_bytes(std::string &data);
 	void write_bytes(void *data, uint32_t data_len);
+	/* Queue the bytes without copying, the conn takes over them */
+	void write_bytes(std::string &&data);
+	void write_bytes(std::vector<uint8_t> &&data);
+	/* Queue the shared payload by reference, the bytes must not be modified until sent */
+	void write_bytes(const SharedSlice &data);
+	/* Queue the file range, it is sent by sendfile after the former bytes */
+	void write_file(const FileSlice &file);
+	/* Append the received bytes which are read by others, i.e. io_uring */
+	void fill_rcv_bytes(const void *data, uint32_t data_len);
+
+	PacketBufPtr & get_send_buf(void)
+	{
+		return send_buf_;
+	}
 
 	void set_peer_info(Peer::ProtoFamily proto_family, const struct sockaddr &addr, socklen_t addrlen) 
 	{
@@ -189,12 +400,72 @@ public:
 		return rcv_buf_;
 	}
 
-	void send_bytes(void);
+	/*
+	Send the queued bytes by sendmsg over all buffers until the socket would block,
+	the caller waits for EPOLLOUT if the bytes are left.
+	Return Value: The bytes sent
+	*/
+	uint64_t send_bytes(void);
+	/* The bytes queued in the send buffer, not written into the socket yet */
+	uint64_t get_pending_send_bytes(void) const
+	{
+		return send_buf_->total_size();
+	}
+	/* The bytes in the socket send queue, not acked by peer yet. -1 means failure */
+	int get_inflight_bytes(void) const;
+
+	/*
+	The owner stops reading the conn when the pending send bytes exceed high, and reads
+	it again when they drop to low. high 0 disables it, low is not more than high.
+	*/
+	void set_send_watermarks(uint64_t high, uint64_t low)
+	{
+		send_high_watermark_ = high;
+		send_low_watermark_ = std::min(low, high);
+	}
+	bool above_send_high_watermark(void) const
+	{
+		return send_high_watermark_ && send_buf_->total_size() > send_high_watermark_;
+	}
+	bool below_send_low_watermark(void) const
+	{
+		return send_buf_->total_size() <= send_low_watermark_;
+	}
+
+	/*
+	Send the slices by MSG_ZEROCOPY when they are not less than bytes, 0 disables it.
+	The slices are held until the kernel reports the completion by the error queue.
+	Return false if the kernel doesn't support SO_ZEROCOPY
+	*/
+	bool set_zerocopy_threshold(uint32_t bytes);
+	/* Release the slices completed by the kernel, the owner calls it when EPOLLERR comes */
+	void reap_zerocopy(void);
+	/* The kernel may still read the slices, the conn should not be closed gracefully */
+	bool zerocopy_pending(void) const
+	{
+		return !zerocopy_sends_.empty();
+	}
 	
 	bool rcv_buf_empty(void) const;
 	bool send_buf_empty(void) const;
+
+	/* The owner links the conn into its ready and write pending lists without allocation */
+	ListNode<Conn> &ready_node(void)
+	{
+		return ready_node_;
+	}
+	ListNode<Conn> &write_node(void)
+	{
+		return write_node_;
+	}
 	
 private:
+	/*
+	The conn is closed before the kernel completes the zero copy sends. Reset the connection,
+	so the slices are never flushed after the holders are released.
+	*/
+	void abort_zerocopy(void);
+
 	PacketBufPtr rcv_buf_;
 	PacketBufPtr send_buf_;
 	Peer peer_;
@@ -203,6 +474,21 @@ private:
 	bool force_close_;
 	bool local_fin_;
 	bool remote_fin_;
+
+	uint64_t send_high_watermark_;
+	uint64_t send_low_watermark_;
+
+	/* The holders of one MSG_ZEROCOPY send, seq_ is counted by the kernel */
+	struct ZeroCopySend {
+		uint32_t seq_;
+		std::vector<std::shared_ptr<const void> > holders_;
+	};
+	uint32_t zerocopy_threshold_;
+	uint32_t zerocopy_seq_;
+	std::vector<ZeroCopySend> zerocopy_sends_;
+
+	ListNode<Conn> ready_node_;
+	ListNode<Conn> write_node_;
 };
 
 typedef std::shared_ptr<Conn> ConnPtr;
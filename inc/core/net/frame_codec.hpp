@@ -0,0 +1,131 @@
+#ifndef FRAME_CODEC_HPP_
+#define FRAME_CODEC_HPP_
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "core/net/conn.hpp"
+
+namespace cppbase {
+
+/*
+The view of one complete frame in the receive buffer, nothing is copied.
+The header is contiguous, the payload may span the buffers.
+They are valid only in the frame callback, the frame is consumed after it.
+*/
+struct Frame {
+	Frame(): header_(NULL), header_size_(0), payload_size_(0) {
+	}
+
+	/* Copy the payload into dst which holds payload_size_ bytes at least */
+	void copy_payload(void *dst) const;
+	std::string payload_str(void) const;
+
+	const uint8_t *header_;
+	uint32_t header_size_;
+	std::vector<struct iovec> payload_;
+	uint32_t payload_size_;
+};
+
+/*
+Find the frame boundary at the head of the receive buffer. The codec keeps no state,
+so one codec could be shared by all conns and servers.
+*/
+class FrameCodec {
+public:
+	enum {
+		FRAME_DEFAULT_MAX_BYTES = 16 * 1024 * 1024,
+	};
+
+	enum DecodeResult {
+		FRAME_DECODE_OK,
+		/* The frame is not complete */
+		FRAME_DECODE_MORE,
+		/* The bytes are not a valid frame, the conn should be closed */
+		FRAME_DECODE_ERROR,
+	};
+
+	/* The frame is header + payload + trailer */
+	struct FrameRange {
+		FrameRange(): header_bytes_(0), payload_bytes_(0), trailer_bytes_(0) {
+		}
+		uint32_t header_bytes_;
+		uint32_t payload_bytes_;
+		uint32_t trailer_bytes_;
+	};
+
+	explicit FrameCodec(uint32_t max_frame_bytes): max_frame_bytes_(max_frame_bytes) {
+	}
+	virtual ~FrameCodec() {
+	}
+
+	/*
+	The header is made contiguous in buf if it spans the buffers.
+	Param:
+		scanned: The bytes checked by the former calls for the same frame, 0 for a new frame.
+			The codec updates it to skip them in the next call.
+	*/
+	virtual DecodeResult decode(PacketBuf &buf, uint64_t &scanned, FrameRange &range) const = 0;
+
+	uint32_t max_frame_bytes(void) const
+	{
+		return max_frame_bytes_;
+	}
+
+protected:
+	uint32_t max_frame_bytes_;
+};
+typedef std::shared_ptr<const FrameCodec> FrameCodecPtr;
+
+/*
+The fixed size header carries the payload length in big endian.
+Param:
+	field_offset/field_bytes: The length field in the header, field_bytes is 1, 2 or 4
+	length_adjust: Added to the field to get the payload bytes, i.e. -header_bytes
+		when the field counts the whole frame
+*/
+class LengthFieldCodec: public FrameCodec {
+public:
+	LengthFieldCodec(uint32_t header_bytes, uint32_t field_offset, uint32_t field_bytes,
+		int32_t length_adjust = 0, uint32_t max_frame_bytes = FRAME_DEFAULT_MAX_BYTES);
+
+	DecodeResult decode(PacketBuf &buf, uint64_t &scanned, FrameRange &range) const;
+
+private:
+	uint32_t header_bytes_;
+	uint32_t field_offset_;
+	uint32_t field_bytes_;
+	int32_t length_adjust_;
+};
+
+/* The payload length is prefixed by the base 128 varint like protobuf, at most 5 bytes */
+class VarintCodec: public FrameCodec {
+public:
+	enum {
+		VARINT_MAX_BYTES = 5,
+	};
+
+	explicit VarintCodec(uint32_t max_frame_bytes = FRAME_DEFAULT_MAX_BYTES): FrameCodec(max_frame_bytes) {
+	}
+
+	DecodeResult decode(PacketBuf &buf, uint64_t &scanned, FrameRange &range) const;
+};
+
+/* The payload ends with the delimiter, i.e. "\r\n". The delimiter is not in the payload */
+class DelimiterCodec: public FrameCodec {
+public:
+	explicit DelimiterCodec(const std::string &delimiter, uint32_t max_frame_bytes = FRAME_DEFAULT_MAX_BYTES);
+
+	DecodeResult decode(PacketBuf &buf, uint64_t &scanned, FrameRange &range) const;
+
+private:
+	std::string delimiter_;
+};
+
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <unistd.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include <memory>
 
@@ -72,6 +73,14 @@ struct Socket {
 		return (0 == setsockopt(sock_, SOL_SOCKET, SO_SNDBUF, (char*)&opt, opt_len));
 	}
 
+	/* The listen socket wakes up the acceptor only when the data arrives, or after secs */
+	bool set_defer_accept(uint32_t secs)
+	{
+		int opt = secs;
+
+		return (0 == setsockopt(sock_, IPPROTO_TCP, TCP_DEFER_ACCEPT, &opt, sizeof(opt)));
+	}
+
 	int sock_;
 };
 
@@ -0,0 +1,87 @@
+#ifndef MPSC_QUEUE_HPP_
+#define MPSC_QUEUE_HPP_
+
+#include <atomic>
+#include <utility>
+
+#include "base/utils/noncopyable.hpp"
+
+namespace cppbase {
+
+/*
+The lock-free multi-producer single-consumer queue (Dmitry Vyukov's algorithm).
+push is wait-free and could be called by any thread, pop must be called by only one thread.
+
+The consumer may see the queue empty when one producer is linking its node,
+so the producer should wake up the consumer after push.
+*/
+template <typename T>
+class MPSCQueue: noncopyable {
+public:
+	MPSCQueue() {
+		Node *stub = new Node();
+		head_.store(stub, std::memory_order_relaxed);
+		tail_ = stub;
+	}
+	~MPSCQueue() {
+		T value;
+		while (pop(value)) {
+		}
+		delete tail_;
+	}
+
+	void push(const T &value) {
+		link(new Node(value));
+	}
+	void push(T &&value) {
+		link(new Node(std::move(value)));
+	}
+
+	/* Only for the consumer. Return false if no value */
+	bool pop(T &value) {
+		Node *tail = tail_;
+		Node *next = tail->next_.load(std::memory_order_acquire);
+
+		if (!next) {
+			return false;
+		}
+
+		// The next becomes the new stub
+		value = std::move(next->value_);
+		next->value_ = T();
+		tail_ = next;
+		delete tail;
+		return true;
+	}
+
+	/* Only for the consumer */
+	bool empty(void) const {
+		return !tail_->next_.load(std::memory_order_acquire);
+	}
+
+private:
+	struct Node {
+		Node(): next_(NULL) {
+		}
+		explicit Node(const T &value): next_(NULL), value_(value) {
+		}
+		explicit Node(T &&value): next_(NULL), value_(std::move(value)) {
+		}
+		std::atomic<Node*> next_;
+		T value_;
+	};
+
+	void link(Node *node) {
+		Node *prev = head_.exchange(node, std::memory_order_acq_rel);
+		prev->next_.store(node, std::memory_order_release);
+	}
+
+	/* The producers append at the head */
+	std::atomic<Node*> head_;
+	/* The consumer pops from the tail, it is the stub node */
+	Node *tail_;
+};
+
+}
+
+#endif
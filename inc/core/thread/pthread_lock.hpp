@@ -19,10 +19,36 @@ public:
 	void unlock() {
 		pthread_mutex_unlock(&mutex_);
 	}
+	pthread_mutex_t *get_mutex() {
+		return &mutex_;
+	}
 private:
 	pthread_mutex_t mutex_;
 };
 
+class Condition {
+public:
+	Condition(Mutex &mutex): mutex_(mutex) {
+		pthread_cond_init(&cond_, NULL);
+	}
+	~Condition() {
+		pthread_cond_destroy(&cond_);
+	}
+	/* The mutex must be locked by the caller */
+	void wait() {
+		pthread_cond_wait(&cond_, mutex_.get_mutex());
+	}
+	void notify() {
+		pthread_cond_signal(&cond_);
+	}
+	void notify_all() {
+		pthread_cond_broadcast(&cond_);
+	}
+private:
+	Mutex &mutex_;
+	pthread_cond_t cond_;
+};
+
 class RWLock {
 public:
 	RWLock() {
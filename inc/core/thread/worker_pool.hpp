@@ -0,0 +1,68 @@
+#ifndef WORKER_POOL_HPP_
+#define WORKER_POOL_HPP_
+
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/utils/noncopyable.hpp"
+#include "core/thread/thread.hpp"
+#include "core/thread/pthread_lock.hpp"
+
+namespace cppbase {
+
+/*
+The worker threads running the tasks. Every worker has its own queue, the tasks
+dispatched with the same key are run by the same worker in the dispatched order.
+*/
+class WorkerPool: noncopyable {
+public:
+	typedef std::function<void (void) > Task;
+
+	WorkerPool(uint32_t worker_cnt, const std::string &name = "worker", bool set_cpu = false);
+	~WorkerPool();
+
+	void start(void);
+	/* The queued tasks are run before the workers stop, the pool can't be restarted */
+	void stop(void);
+
+	/* Thread safe */
+	void dispatch(uint32_t key, const Task &task);
+	void dispatch(uint32_t key, Task &&task);
+
+	uint32_t size(void) const
+	{
+		return workers_.size();
+	}
+
+private:
+	struct Worker {
+		Worker(): cond_(lock_), stop_(false) {
+		}
+		Mutex lock_;
+		Condition cond_;
+		std::deque<Task> tasks_;
+		bool stop_;
+	};
+
+	void run_worker(void *data);
+	Worker *get_worker(uint32_t key) const
+	{
+		return workers_[key % workers_.size()].get();
+	}
+
+	std::vector<std::unique_ptr<Worker> > workers_;
+	ThreadPool thr_pool_;
+	std::string name_;
+	bool started_;
+};
+
+typedef std::shared_ptr<WorkerPool> WorkerPoolPtr;
+
+}
+
+#endif
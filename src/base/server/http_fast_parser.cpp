@@ -0,0 +1,418 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SIMD_X86
+#endif
+
+#include <algorithm>
+
+#include "base/server/http_fast_parser.hpp"
+#include "base/utils/compiler.hpp"
+
+using namespace std;
+
+namespace cppbase {
+
+struct SimdSupport {
+	SimdSupport() {
+#ifdef HTTP_SIMD_X86
+		__builtin_cpu_init();
+		sse42_ = __builtin_cpu_supports("sse4.2");
+		avx2_ = __builtin_cpu_supports("avx2");
+#else
+		sse42_ = false;
+		avx2_ = false;
+#endif
+		use_sse42_ = sse42_;
+		use_avx2_ = avx2_;
+	}
+
+	bool sse42_;
+	bool avx2_;
+	bool use_sse42_;
+	bool use_avx2_;
+};
+static SimdSupport simd_support;
+
+/* The tchar of RFC 7230, the method and header names are made of them */
+struct TokenCharMap {
+	TokenCharMap() {
+		memset(map_, 0, sizeof(map_));
+		for (int c = '0'; c <= '9'; ++c) {
+			map_[c] = true;
+		}
+		for (int c = 'a'; c <= 'z'; ++c) {
+			map_[c] = true;
+			map_[c - 'a' + 'A'] = true;
+		}
+		for (const char *c = "!#$%&'*+-.^_`|~"; *c; ++c) {
+			map_[static_cast<uint8_t>(*c)] = true;
+		}
+	}
+
+	bool map_[256];
+};
+static TokenCharMap token_chars;
+
+static inline bool is_path_end(uint8_t c)
+{
+	return c <= ' ' || c == 0x7f;
+}
+
+/* The control chars except HT end the header value, the obs-text >= 0x80 is allowed */
+static inline bool is_value_end(uint8_t c)
+{
+	return (c < ' ' && c != '\t') || c == 0x7f;
+}
+
+#ifdef HTTP_SIMD_X86
+/*
+The ranges are the pairs of the inclusive bounds for pcmpestri, padded to 16 bytes.
+The token ranges stop at some tchars like '|' and '~' too, they are checked by the scalar loop.
+*/
+alignas(16) static const char TOKEN_END_RANGES[17] = "\x00 \"\"(),,//:@[]{\xff";
+alignas(16) static const char PATH_END_RANGES[17] = "\x00\x20\x7f\x7f";
+alignas(16) static const char VALUE_END_RANGES[17] = "\x00\x08\x0a\x1f\x7f\x7f";
+
+/* Return the first byte in the ranges, or the tail shorter than 16 bytes */
+__attribute__((target("sse4.2")))
+static const char *find_ranges_sse42(const char *pos, const char *end, const char *ranges, int ranges_size)
+{
+	__m128i ranges16 = _mm_load_si128(reinterpret_cast<const __m128i*>(ranges));
+
+	while (end - pos >= 16) {
+		__m128i data16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+		int idx = _mm_cmpestri(ranges16, ranges_size, data16, 16,
+			_SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+
+		if (idx != 16) {
+			return pos + idx;
+		}
+		pos += 16;
+	}
+	return pos;
+}
+
+/*
+Return the first control char, or the tail shorter than 32 bytes.
+Param:
+	bound: The bytes below it are the control chars, ' ' + 1 makes the space one of them
+	allow_tab: The HT is not taken as the control char
+*/
+__attribute__((target("avx2")))
+static const char *find_ctl_avx2(const char *pos, const char *end, char bound, bool allow_tab)
+{
+	const __m256i bound32 = _mm256_set1_epi8(bound);
+	const __m256i zero32 = _mm256_setzero_si256();
+	const __m256i del32 = _mm256_set1_epi8(0x7f);
+	const __m256i tab32 = _mm256_set1_epi8('\t');
+
+	while (end - pos >= 32) {
+		__m256i data32 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos));
+		// The signed compare takes the bytes >= 0x80 as negative, they are excluded from the control chars
+		__m256i ctl = _mm256_andnot_si256(_mm256_cmpgt_epi8(zero32, data32), _mm256_cmpgt_epi8(bound32, data32));
+
+		ctl = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(data32, del32));
+		if (allow_tab) {
+			ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(data32, tab32), ctl);
+		}
+
+		uint32_t mask = _mm256_movemask_epi8(ctl);
+		if (mask) {
+			return pos + __builtin_ctz(mask);
+		}
+		pos += 32;
+	}
+	return pos;
+}
+#endif
+
+static const char *find_token_end(const char *pos, const char *end)
+{
+#ifdef HTTP_SIMD_X86
+	if (likely(simd_support.use_sse42_)) {
+		pos = find_ranges_sse42(pos, end, TOKEN_END_RANGES, 16);
+	}
+#endif
+	while (pos < end && token_chars.map_[static_cast<uint8_t>(*pos)]) {
+		++pos;
+	}
+	return pos;
+}
+
+static const char *find_path_end(const char *pos, const char *end)
+{
+#ifdef HTTP_SIMD_X86
+	if (likely(simd_support.use_avx2_)) {
+		pos = find_ctl_avx2(pos, end, ' ' + 1, false);
+	} else if (likely(simd_support.use_sse42_)) {
+		pos = find_ranges_sse42(pos, end, PATH_END_RANGES, 4);
+	}
+#endif
+	while (pos < end && !is_path_end(*pos)) {
+		++pos;
+	}
+	return pos;
+}
+
+static const char *find_value_end(const char *pos, const char *end)
+{
+#ifdef HTTP_SIMD_X86
+	if (likely(simd_support.use_avx2_)) {
+		pos = find_ctl_avx2(pos, end, ' ', true);
+	} else if (likely(simd_support.use_sse42_)) {
+		pos = find_ranges_sse42(pos, end, VALUE_END_RANGES, 6);
+	}
+#endif
+	while (pos < end && !is_value_end(*pos)) {
+		++pos;
+	}
+	return pos;
+}
+
+/* Skip the CRLF or the bare LF, return 0 on success */
+static int skip_eol(const char *&pos, const char *end)
+{
+	if (pos == end) {
+		return HTTPFastParser::HTTP_HEAD_INCOMPLETE;
+	}
+	if (*pos == '\r' && ++pos == end) {
+		return HTTPFastParser::HTTP_HEAD_INCOMPLETE;
+	}
+	if (*pos != '\n') {
+		return HTTPFastParser::HTTP_HEAD_ERROR;
+	}
+	++pos;
+	return 0;
+}
+
+int HTTPFastParser::parse_request(const char *data, size_t len, HTTPRequestHead &head)
+{
+	const char *pos = data;
+	const char *end = data + len;
+	const char *token;
+	int ret;
+
+	head.header_cnt_ = 0;
+
+	// Some clients send an empty line after the body of POST
+	if (pos < end && (*pos == '\r' || *pos == '\n')) {
+		if ((ret = skip_eol(pos, end))) {
+			return ret;
+		}
+	}
+
+	token = pos;
+	pos = find_token_end(pos, end);
+	if (pos == end) {
+		return HTTP_HEAD_INCOMPLETE;
+	}
+	if (pos == token || *pos != ' ') {
+		return HTTP_HEAD_ERROR;
+	}
+	head.method_ = StrView(token, pos - token);
+	++pos;
+
+	token = pos;
+	pos = find_path_end(pos, end);
+	if (pos == end) {
+		return HTTP_HEAD_INCOMPLETE;
+	}
+	if (pos == token || *pos != ' ') {
+		return HTTP_HEAD_ERROR;
+	}
+	head.path_ = StrView(token, pos - token);
+	++pos;
+
+	if (end - pos < 8) {
+		return HTTP_HEAD_INCOMPLETE;
+	}
+	if (memcmp(pos, "HTTP/1.", 7) || pos[7] < '0' || pos[7] > '9') {
+		return HTTP_HEAD_ERROR;
+	}
+	head.minor_version_ = pos[7] - '0';
+	pos += 8;
+	if ((ret = skip_eol(pos, end))) {
+		return ret;
+	}
+
+	for (;;) {
+		if (pos == end) {
+			return HTTP_HEAD_INCOMPLETE;
+		}
+		if (*pos == '\r' || *pos == '\n') {
+			if ((ret = skip_eol(pos, end))) {
+				return ret;
+			}
+			return pos - data;
+		}
+		if (head.header_cnt_ == HTTPRequestHead::HTTP_MAX_HEADERS) {
+			return HTTP_HEAD_ERROR;
+		}
+
+		// The obsolete line folding starts with the space, it is rejected as RFC 7230 allows
+		HTTPHeaderField &field = head.headers_[head.header_cnt_];
+
+		token = pos;
+		pos = find_token_end(pos, end);
+		if (pos == end) {
+			return HTTP_HEAD_INCOMPLETE;
+		}
+		if (pos == token || *pos != ':') {
+			return HTTP_HEAD_ERROR;
+		}
+		field.name_ = StrView(token, pos - token);
+		++pos;
+
+		while (pos < end && (*pos == ' ' || *pos == '\t')) {
+			++pos;
+		}
+		token = pos;
+		pos = find_value_end(pos, end);
+
+		const char *value_end = pos;
+		if ((ret = skip_eol(pos, end))) {
+			return ret;
+		}
+		while (value_end > token && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+			--value_end;
+		}
+		field.value_ = StrView(token, value_end - token);
+		++head.header_cnt_;
+	}
+}
+
+void HTTPFastParser::enable_simd(bool enable)
+{
+	simd_support.use_sse42_ = enable && simd_support.sse42_;
+	simd_support.use_avx2_ = enable && simd_support.avx2_;
+}
+
+static inline int hex_value(char c)
+{
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+void HTTPChunkedDecoder::reset(void)
+{
+	state_ = CHUNK_SIZE;
+	size_digits_ = 0;
+	left_ = 0;
+}
+
+HTTPChunkedDecoder::Result HTTPChunkedDecoder::decode(const char *data, size_t len, size_t &used, StrView &piece)
+{
+	const char *pos = data;
+	const char *end = data + len;
+	const char *lf;
+	int digit;
+
+	while (pos < end) {
+		switch (state_) {
+		case CHUNK_SIZE:
+			digit = hex_value(*pos);
+			if (digit >= 0) {
+				// The size is limited to 60 bits, it never overflows
+				if (++size_digits_ > 15) {
+					used = pos - data;
+					return CHUNK_ERROR;
+				}
+				left_ = (left_ << 4) | digit;
+			} else if (size_digits_ == 0) {
+				used = pos - data;
+				return CHUNK_ERROR;
+			} else if (*pos == ';' || *pos == ' ' || *pos == '\t') {
+				state_ = CHUNK_EXT;
+			} else if (*pos == '\r') {
+				state_ = CHUNK_SIZE_LF;
+			} else {
+				used = pos - data;
+				return CHUNK_ERROR;
+			}
+			++pos;
+			break;
+		case CHUNK_EXT:
+			lf = static_cast<const char*>(memchr(pos, '\n', end - pos));
+			if (!lf) {
+				pos = end;
+				break;
+			}
+			pos = lf + 1;
+			state_ = left_ ? CHUNK_BODY : CHUNK_TRAILER_START;
+			break;
+		case CHUNK_SIZE_LF:
+			if (*pos++ != '\n') {
+				used = pos - data;
+				return CHUNK_ERROR;
+			}
+			state_ = left_ ? CHUNK_BODY : CHUNK_TRAILER_START;
+			break;
+		case CHUNK_BODY: {
+			size_t bytes = min(left_, static_cast<uint64_t>(end - pos));
+
+			piece = StrView(pos, bytes);
+			pos += bytes;
+			left_ -= bytes;
+			if (!left_) {
+				state_ = CHUNK_BODY_CR;
+			}
+			used = pos - data;
+			return CHUNK_DATA;
+		}
+		case CHUNK_BODY_CR:
+			if (*pos++ != '\r') {
+				used = pos - data;
+				return CHUNK_ERROR;
+			}
+			state_ = CHUNK_BODY_LF;
+			break;
+		case CHUNK_BODY_LF:
+			if (*pos++ != '\n') {
+				used = pos - data;
+				return CHUNK_ERROR;
+			}
+			state_ = CHUNK_SIZE;
+			size_digits_ = 0;
+			break;
+		case CHUNK_TRAILER_START:
+			if (*pos == '\r') {
+				state_ = CHUNK_TRAILER_END_LF;
+				++pos;
+			} else {
+				state_ = CHUNK_TRAILER_LINE;
+			}
+			break;
+		case CHUNK_TRAILER_LINE:
+			lf = static_cast<const char*>(memchr(pos, '\n', end - pos));
+			if (!lf) {
+				pos = end;
+				break;
+			}
+			pos = lf + 1;
+			state_ = CHUNK_TRAILER_START;
+			break;
+		case CHUNK_TRAILER_END_LF:
+			if (*pos++ != '\n') {
+				used = pos - data;
+				return CHUNK_ERROR;
+			}
+			used = pos - data;
+			return CHUNK_DONE;
+		}
+	}
+
+	used = len;
+	return CHUNK_MORE;
+}
+
+}
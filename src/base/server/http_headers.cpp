@@ -0,0 +1,107 @@
+#include <stdint.h>
+
+#include "base/server/http_headers.hpp"
+#include "base/utils/compiler.hpp"
+
+namespace cppbase {
+
+struct KnownHeader {
+	const char *name_;
+	size_t size_;
+};
+
+#define HTTP_KNOWN_HEADER(name)		{name, sizeof(name) - 1}
+
+/* In the order of HTTPHeaderId */
+static constexpr KnownHeader KNOWN_HEADERS[] = {
+	HTTP_KNOWN_HEADER("Host"),
+	HTTP_KNOWN_HEADER("Content-Length"),
+	HTTP_KNOWN_HEADER("Content-Type"),
+	HTTP_KNOWN_HEADER("Content-Encoding"),
+	HTTP_KNOWN_HEADER("Connection"),
+	HTTP_KNOWN_HEADER("Keep-Alive"),
+	HTTP_KNOWN_HEADER("Transfer-Encoding"),
+	HTTP_KNOWN_HEADER("Upgrade"),
+	HTTP_KNOWN_HEADER("Expect"),
+	HTTP_KNOWN_HEADER("User-Agent"),
+	HTTP_KNOWN_HEADER("Accept"),
+	HTTP_KNOWN_HEADER("Accept-Encoding"),
+	HTTP_KNOWN_HEADER("Accept-Language"),
+	HTTP_KNOWN_HEADER("Cookie"),
+	HTTP_KNOWN_HEADER("Authorization"),
+	HTTP_KNOWN_HEADER("Referer"),
+	HTTP_KNOWN_HEADER("Origin"),
+	HTTP_KNOWN_HEADER("If-None-Match"),
+	HTTP_KNOWN_HEADER("If-Modified-Since"),
+	HTTP_KNOWN_HEADER("Cache-Control"),
+	HTTP_KNOWN_HEADER("Range"),
+	HTTP_KNOWN_HEADER("X-Forwarded-For"),
+	HTTP_KNOWN_HEADER("X-Real-IP"),
+	HTTP_KNOWN_HEADER("X-Request-Id"),
+};
+static_assert(sizeof(KNOWN_HEADERS) / sizeof(KNOWN_HEADERS[0]) == HTTP_HEADER_KNOWN_CNT,
+	"The known headers mismatch HTTPHeaderId");
+
+enum {
+	HEADER_HASH_SLOTS = 64,
+};
+
+/* The case bit is set to lower the letters, the factors are picked to keep the known names apart */
+static constexpr uint32_t header_hash(const char *name, size_t size)
+{
+	return (size + 7 * (static_cast<uint8_t>(name[0]) | 0x20) + 24 * (static_cast<uint8_t>(name[size - 1]) | 0x20))
+		& (HEADER_HASH_SLOTS - 1);
+}
+
+static constexpr uint32_t known_hash(uint32_t id)
+{
+	return header_hash(KNOWN_HEADERS[id].name_, KNOWN_HEADERS[id].size_);
+}
+
+static constexpr bool hash_unique(uint32_t id, uint32_t other)
+{
+	return other == HTTP_HEADER_KNOWN_CNT || (known_hash(id) != known_hash(other) && hash_unique(id, other + 1));
+}
+
+static constexpr bool hash_perfect(uint32_t id)
+{
+	return id == HTTP_HEADER_KNOWN_CNT || (hash_unique(id, id + 1) && hash_perfect(id + 1));
+}
+static_assert(hash_perfect(0), "The known headers collide in header_hash, pick other factors");
+
+static constexpr uint8_t slot_header(uint32_t slot, uint32_t id)
+{
+	return id == HTTP_HEADER_KNOWN_CNT ? HTTP_HEADER_UNKNOWN : (known_hash(id) == slot ? id : slot_header(slot, id + 1));
+}
+
+#define HEADER_SLOTS4(s)	slot_header(s, 0), slot_header(s + 1, 0), slot_header(s + 2, 0), slot_header(s + 3, 0)
+#define HEADER_SLOTS16(s)	HEADER_SLOTS4(s), HEADER_SLOTS4(s + 4), HEADER_SLOTS4(s + 8), HEADER_SLOTS4(s + 12)
+
+/* The hash slot to the id, it is built by the compiler */
+static constexpr uint8_t HEADER_SLOTS[HEADER_HASH_SLOTS] = {
+	HEADER_SLOTS16(0), HEADER_SLOTS16(16), HEADER_SLOTS16(32), HEADER_SLOTS16(48),
+};
+
+HTTPHeaderId get_http_header_id(const StrView &name)
+{
+	if (unlikely(name.empty())) {
+		return HTTP_HEADER_UNKNOWN;
+	}
+
+	uint8_t id = HEADER_SLOTS[header_hash(name.data(), name.size())];
+
+	if (id != HTTP_HEADER_UNKNOWN && name.equal_nocase(StrView(KNOWN_HEADERS[id].name_, KNOWN_HEADERS[id].size_))) {
+		return static_cast<HTTPHeaderId>(id);
+	}
+	return HTTP_HEADER_UNKNOWN;
+}
+
+StrView get_http_header_name(HTTPHeaderId id)
+{
+	if (id >= HTTP_HEADER_KNOWN_CNT) {
+		return StrView();
+	}
+	return StrView(KNOWN_HEADERS[id].name_, KNOWN_HEADERS[id].size_);
+}
+
+}
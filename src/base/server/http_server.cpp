@@ -4,6 +4,9 @@
 #include "base/utils/singleton.hpp"
 #include "base/utils/utils.hpp"
 
+#include <string.h>
+
+#include <algorithm>
 #include <locale>
 using namespace std;
 
@@ -13,8 +16,7 @@ int on_uri_cb(http_parser * parser, const char * at, size_t length)
 {
 	HTTPRequestImpl *req = reinterpret_cast<HTTPRequestImpl *> (parser->data);
 
-	req->uri_.append(at, length);
-	LOG_DBUG("URI:%s", req->uri_.c_str());
+	req->append_token(req->uri_, at, length);
 
 	return 0;
 }
@@ -23,9 +25,14 @@ int on_header_field_cb(http_parser * parser, const char * at, size_t length)
 {
 	HTTPRequestImpl *req = reinterpret_cast<HTTPRequestImpl *> (parser->data);
 
-	if (length) {
-		req->header_field_.append(at, length);
+	if (req->in_value_ || req->headers_.empty()) {
+		if (req->headers_.size()) {
+			req->index_header(req->headers_.size() - 1);
+		}
+		req->headers_.push_back(HTTPRequestImpl::Header());
+		req->in_value_ = false;
 	}
+	req->append_token(req->headers_.back().field_, at, length);
 
 	return 0;
 }
@@ -34,17 +41,9 @@ int on_header_value_cb(http_parser * parser, const char * at, size_t length)
 {
 	HTTPRequestImpl *req = reinterpret_cast<HTTPRequestImpl *> (parser->data);
 
-	if (length) {
-		string value(at, length);
-		
-		StrToLower(req->header_field_);		
-		req->headers_[req->header_field_] += value;
-		LOG_DBUG("HEADER[%s: %s]", req->header_field_.c_str(), req->headers_[req->header_field_].c_str());
-	}
-
-	if (!length || at[length] == '\r') {
-		req->header_field_.clear();
-	}
+	// The value may be split by the buffer boundary, the header ends when the next field comes
+	req->in_value_ = true;
+	req->append_token(req->headers_.back().value_, at, length);
 
 	return 0;
 }
@@ -53,14 +52,19 @@ int on_body_cb(http_parser * parser, const char * at, size_t length)
 {
 	HTTPRequestImpl *req = reinterpret_cast<HTTPRequestImpl *> (parser->data);
 	
-	req->body_.append(at, length);
+	req->append_body(at, length);
 
-    LOG_DBUG("BODY: %s", req->body_.c_str());
 	return 0;
 }
 
 int on_headers_complete_cb(http_parser * parser)
 {
+	HTTPRequestImpl *req = reinterpret_cast<HTTPRequestImpl *> (parser->data);
+
+	if (req->headers_.size()) {
+		req->index_header(req->headers_.size() - 1);
+	}
+	req->headers_done_ = true;
 	return 0;
 }
 
@@ -71,6 +75,8 @@ int on_message_complete_cb(http_parser *parser)
     LOG_DBUG("keep-alive: %d, parse_state: %d", http_should_keep_alive(parser), parser->state); 
 
 	req->is_completed_ = true;
+	// Stop at the end of the request, the left bytes are parsed after it is handled
+	http_parser_pause(parser, 1);
 	return 0;
 }
 
@@ -98,7 +104,7 @@ const std::string * HTTPRequest::get_uri(void)
 	return impl_->get_uri();
 }
 
-const std::string * HTTPRequest::get_header(const std::string &header_name)
+const std::string * HTTPRequest::get_header(const StrView &header_name)
 {
 	return impl_->get_http_header(header_name);
 }
@@ -108,6 +114,36 @@ const std::string * HTTPRequest::get_body(void)
 	return impl_->get_body();
 }
 
+StrView HTTPRequest::get_uri_view(void) const
+{
+	return impl_->get_uri_view();
+}
+
+StrView HTTPRequest::get_header_view(const StrView &header_name) const
+{
+	return impl_->get_header_view(header_name);
+}
+
+StrView HTTPRequest::get_header_view(HTTPHeaderId id) const
+{
+	return impl_->get_header_view(id);
+}
+
+StrView HTTPRequest::get_body_view(void) const
+{
+	return impl_->get_body_view();
+}
+
+void HTTPRequest::set_context(const std::shared_ptr<void> &context)
+{
+	impl_->set_context(context);
+}
+
+const std::shared_ptr<void> &HTTPRequest::get_context(void) const
+{
+	return impl_->get_context();
+}
+
 HTTPServer::HTTPServer(uint32_t ip, uint16_t port)
 {
 	impl_ = make_shared<HTTPServerImpl>(ip, port);
@@ -128,6 +164,17 @@ void HTTPServer::set_request_callback(const HTTPRequestCallback &cb)
 	impl_->set_request_callback(cb);
 }
 
+void HTTPServer::set_stream_callbacks(const HTTPRequestCallback &on_headers, const HTTPBodyChunkCallback &on_body_chunk,
+	const HTTPRequestCallback &on_complete)
+{
+	impl_->set_stream_callbacks(on_headers, on_body_chunk, on_complete);
+}
+
+void HTTPServer::set_parser(HTTPParserType type)
+{
+	impl_->set_parser(type);
+}
+
 void HTTPServer::set_exit_callback(const ExitCallback &cb)
 {
 	impl_->set_exit_callback(cb);
@@ -143,9 +190,14 @@ void HTTPServer::set_period_timer_callback(const PeriodTimerCallback &cb, void *
 	impl_->set_period_timer_callback(cb, data);
 }
 
-void HTTPServer::add_oneshot_timer(const OneshotTimerCallback &cb, uint64_t nsecs, void *data) throw (Errno)
+OneshotTimerId HTTPServer::add_oneshot_timer(const OneshotTimerCallback &cb, uint64_t nsecs, void *data) throw (Errno)
+{
+	return impl_->add_oneshot_timer(cb, nsecs, data);
+}
+
+bool HTTPServer::cancel_oneshot_timer(OneshotTimerId id)
 {
-	impl_->add_oneshot_timer(cb, nsecs, data);
+	return impl_->cancel_oneshot_timer(id);
 }
 
 void HTTPServer::add_signal(int signo)
@@ -180,6 +232,8 @@ void HTTPServerImpl::process_conn(const ConnPtr & conn, ConnEvent event)
         LOG_INFO("HTTPServer accepts new conn: %s", conn->to_str());
 
 		HTTPRequest::HTTPRequestPtr req = make_shared<HTTPRequest>();
+		req->impl_->set_parser(parser_type_);
+		req->impl_->set_streaming(static_cast<bool>(body_chunk_cb_));
 		conn_reqs_[conn] = req;
 	} else {
 		LOG_INFO("HTTPServer disconnect conn: %s",  conn->to_str());
@@ -197,66 +251,275 @@ void HTTPServerImpl::process_msg(const ConnPtr & conn, PacketBufPtr & msg)
         return;
 	}
 
-	HTTPRequest::HTTPRequestPtr request = it->second;
-	uint8_t *data;
-	uint32_t data_len;
+	if (conn->is_local_fin()) {
+		// Closing after the last response, the bytes from peer are dropped
+		msg->consume_bytes(msg->total_size());
+		return;
+	}
 
-	msg->peek_cur_data(&data, &data_len);
-	BUG_ON(data_len == 0);
+	HTTPRequest::HTTPRequestPtr request = it->second;
+	HTTPRequestImpl *impl = request->impl_.get();
 
 	try {
-		if (request->impl_->parse_msg(data, data_len)) {
+		// The pipelined requests are handled one by one, their responses are queued in order
+		for (uint32_t i = 0; i < HTTP_PIPELINE_BUDGET && !msg->empty(); ++i) {
+			bool completed = impl->parse(*msg, iov_, head_);
+
+			if (body_chunk_cb_ && !stream_request(conn, request, msg, completed)) {
+				break;
+			}
+			if (!completed) {
+				break;
+			}
+
+			bool keep = true;
 			if (req_cb_) {
 				string response;
-				bool keep = req_cb_(request, response);
 
+				keep = req_cb_(request, response);
 				if (response.size()) {
-					conn->write_bytes(response);
-				}
-
-				if (!keep) {
-					LOG_DBUG("HTTP Server disconnect the conn: %s", conn->to_str());
-					conn->grace_close();
+					conn->write_bytes(std::move(response));
 				}
 			}
-            request->impl_->clear();
+			// The tokens refer to the bytes, they are released with the request
+			msg->consume_bytes(impl->parsed_bytes());
+			impl->clear();
+
+			if (!keep) {
+				// The requests after it are never answered
+				LOG_DBUG("HTTP Server disconnect the conn: %s", conn->to_str());
+				conn->grace_close();
+				msg->consume_bytes(msg->total_size());
+				break;
+			}
+			// The left requests are handled after the responses are sent
+			if (conn->is_force_close() || conn->above_send_high_watermark()) {
+				break;
+			}
 		}
-        msg->consume_bytes(data_len);
 	} catch (string &e) {
 		LOG_ERRO("Fail to parse packet: %s", e.c_str());
+		// The bytes could not be parsed any more
+		conn->force_close();
 		return;
 	}
     LOG_TRAC("end");
 }
 
-HTTPRequestImpl::HTTPRequestImpl()
+bool HTTPServerImpl::stream_request(const ConnPtr &conn, const HTTPRequest::HTTPRequestPtr &request,
+	PacketBufPtr &msg, bool completed)
+{
+	HTTPRequestImpl *impl = request->impl_.get();
+	vector<StrView> &pieces = impl->body_pieces();
+	bool keep = true;
+
+	if (impl->notify_headers() && headers_cb_) {
+		string response;
+
+		keep = headers_cb_(request, response);
+		if (response.size()) {
+			conn->write_bytes(std::move(response));
+		}
+	}
+	for (auto it = pieces.begin(); keep && it != pieces.end(); ++it) {
+		keep = body_chunk_cb_(request, *it);
+	}
+	pieces.clear();
+
+	if (!keep) {
+		LOG_DBUG("HTTP Server stops streaming the conn: %s", conn->to_str());
+		conn->grace_close();
+		msg->consume_bytes(msg->total_size());
+		impl->clear();
+		return false;
+	}
+	// The delivered body is released at once, the complete request is consumed after on_complete
+	if (!completed && impl->headers_done()) {
+		msg->consume_bytes(impl->release_parsed());
+	}
+	return true;
+}
+
+HTTPRequestImpl::HTTPRequestImpl(): parser_type_(HTTP_PARSER_STATE_MACHINE), streaming_(false)
 {
 	parser_.data = this;
 	
 	setting_ = &Singleton<HTTPParseSetting>::instance_ptr()->setting_;
 	
-	unread_pos_ = 0;
-	left_bytes_ = 0;
 	clear();
 }
 
-bool HTTPRequestImpl::parse_msg(uint8_t * data, uint32_t data_len) throw (std::string)
+bool HTTPRequestImpl::parse(PacketBuf &msg, vector<struct iovec> &iov, HTTPRequestHead &head) throw (std::string)
+{
+	if (parser_type_ == HTTP_PARSER_SIMD) {
+		if (!head_parsed_ && !parse_head(msg, head)) {
+			return false;
+		}
+		is_completed_ = parse_body(msg, iov);
+		return is_completed_;
+	}
+
+	// The bytes of the partial request stay in the buffer, only the new ones are parsed
+	iov.clear();
+	msg.peek_range_iov(parsed_bytes_, msg.total_size() - parsed_bytes_, iov);
+	for (auto it = iov.begin(); it != iov.end(); ++it) {
+		uint32_t parsed;
+
+		if (parse_msg(static_cast<uint8_t*>(it->iov_base), it->iov_len, parsed)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool HTTPRequestImpl::parse_head(PacketBuf &msg, HTTPRequestHead &head) throw (std::string)
+{
+	int64_t head_bytes = -1;
+	int64_t pos;
+
+	// The head ends with the empty line, both CRLF and the bare LF end the lines like parse_request
+	while ((pos = msg.find_bytes("\n", 1, head_scanned_)) != -1 && pos < HTTP_MAX_HEAD_BYTES) {
+		uint64_t line_bytes = pos - head_line_;
+
+		head_scanned_ = pos + 1;
+		if (line_bytes == 0 || (line_bytes == 1 && msg.byte_at(head_line_) == '\r')) {
+			if (head_line_) {
+				head_bytes = pos + 1;
+				break;
+			}
+			// The empty line before the request line is skipped by parse_request
+		}
+		head_line_ = pos + 1;
+	}
+
+	if (head_bytes == -1) {
+		uint64_t total = msg.total_size();
+
+		if (total > HTTP_MAX_HEAD_BYTES) {
+			LOG_ERRO("No end of HTTP head in %lu bytes", total);
+			throw string("Too large HTTP head");
+		}
+		head_scanned_ = total;
+		return false;
+	}
+
+	// The tokens must be contiguous, the head is copied only when it spans the buffers
+	const char *data = reinterpret_cast<const char*>(msg.linearize(head_bytes));
+	int ret = HTTPFastParser::HTTP_HEAD_ERROR;
+
+	if (data) {
+		ret = HTTPFastParser::parse_request(data, head_bytes, head);
+	}
+	if (ret <= 0) {
+		LOG_ERRO("invalid HTTP request head: %d", ret);
+		throw string("Invalid HTTP requst");
+	}
+
+	bool content_length = false;
+
+	uri_.view_ = head.path_;
+	for (uint32_t i = 0; i < head.header_cnt_; ++i) {
+		const HTTPHeaderField &field = head.headers_[i];
+		Header header;
+
+		header.field_.view_ = field.name_;
+		header.value_.view_ = field.value_;
+		headers_.push_back(header);
+
+		HTTPHeaderId id = index_header(i);
+		if (id == HTTP_HEADER_TRANSFER_ENCODING) {
+			// The chunked must be the last coding
+			const StrView &value = field.value_;
+
+			chunked_ = value.size() >= 7 && StrView(value.data() + value.size() - 7, 7).equal_nocase("chunked");
+		} else if (id == HTTP_HEADER_CONTENT_LENGTH) {
+			const StrView &value = field.value_;
+			uint64_t length = 0;
+
+			// The repeated one is rejected even if the values are the same, the body may be smuggled
+			if (value.empty() || value.size() > 18 || content_length) {
+				LOG_ERRO("invalid Content-Length: %.*s", static_cast<int>(value.size()), value.data());
+				throw string("Invalid HTTP requst");
+			}
+			for (size_t j = 0; j < value.size(); ++j) {
+				if (value.data()[j] < '0' || value.data()[j] > '9') {
+					LOG_ERRO("invalid Content-Length: %.*s", static_cast<int>(value.size()), value.data());
+					throw string("Invalid HTTP requst");
+				}
+				length = length * 10 + value.data()[j] - '0';
+			}
+			body_left_ = length;
+			content_length = true;
+		}
+	}
+	if (chunked_ && content_length) {
+		LOG_ERRO("Both chunked and Content-Length are in the HTTP request");
+		throw string("Invalid HTTP requst");
+	}
+
+	parsed_bytes_ = ret;
+	head_parsed_ = true;
+	headers_done_ = true;
+	return true;
+}
+
+bool HTTPRequestImpl::parse_body(PacketBuf &msg, vector<struct iovec> &iov) throw (std::string)
+{
+	uint64_t avail = msg.total_size() - parsed_bytes_;
+
+	if (!chunked_) {
+		uint64_t bytes = min(avail, body_left_);
+
+		iov.clear();
+		if (bytes) {
+			msg.peek_range_iov(parsed_bytes_, bytes, iov);
+		}
+		for (auto it = iov.begin(); it != iov.end(); ++it) {
+			append_body(static_cast<const char*>(it->iov_base), it->iov_len);
+		}
+		parsed_bytes_ += bytes;
+		body_left_ -= bytes;
+		return body_left_ == 0;
+	}
+
+	iov.clear();
+	msg.peek_range_iov(parsed_bytes_, avail, iov);
+	for (auto it = iov.begin(); it != iov.end(); ++it) {
+		const char *data = static_cast<const char*>(it->iov_base);
+		size_t left = it->iov_len;
+
+		while (left) {
+			StrView piece;
+			size_t used;
+			HTTPChunkedDecoder::Result ret = chunked_decoder_.decode(data, left, used, piece);
+
+			data += used;
+			left -= used;
+			parsed_bytes_ += used;
+			if (ret == HTTPChunkedDecoder::CHUNK_DATA) {
+				append_body(piece.data(), piece.size());
+			} else if (ret == HTTPChunkedDecoder::CHUNK_DONE) {
+				return true;
+			} else if (ret == HTTPChunkedDecoder::CHUNK_ERROR) {
+				LOG_ERRO("invalid HTTP chunked body");
+				throw string("Invalid HTTP requst");
+			}
+		}
+	}
+	return false;
+}
+
+bool HTTPRequestImpl::parse_msg(const uint8_t * data, uint32_t data_len, uint32_t &parsed) throw (std::string)
 {
     LOG_TRAC("begin");
     //LOG_DUMP("parse_msg", data, data_len);
-	bytes_.insert(bytes_.end(), data, data+data_len);
-	left_bytes_ += data_len;
-
-    //LOG_DUMP("http_parser_execute before", &bytes_[unread_pos_], left_bytes_);
-    LOG_DBUG("There are %u bytes waiting to parse", left_bytes_);
-	size_t parsed_size = http_parser_execute(&parser_, setting_, &bytes_[unread_pos_], left_bytes_);
-	LOG_DBUG("http parsed %u bytes", parsed_size);
-    //LOG_DUMP("http_parser_execute after", &bytes_[unread_pos_], left_bytes_);
-	unread_pos_ += parsed_size;
-	left_bytes_ -= parsed_size;
+    LOG_DBUG("There are %u bytes waiting to parse", data_len);
+	parsed = http_parser_execute(&parser_, setting_, reinterpret_cast<const char*>(data), data_len);
+	parsed_bytes_ += parsed;
+	LOG_DBUG("http parsed %u bytes", parsed);
 
     std::string err_msg = "unknow";
-	if (parser_.http_errno) {
+	if (parser_.http_errno && HTTP_PARSER_ERRNO(&parser_) != HPE_PAUSED) {
         err_msg = http_errno_description(HTTP_PARSER_ERRNO(&parser_));
         LOG_ERRO("invalid HTTP request: %s", err_msg.c_str());
 		throw string("Invalid HTTP requst");
@@ -274,34 +537,141 @@ bool HTTPRequestImpl::parse_msg(uint8_t * data, uint32_t data_len) throw (std::s
 	return false;
 }
 
-const string *HTTPRequestImpl::get_uri(void)
+void HTTPRequestImpl::append_token(Token &token, const char *at, size_t length)
 {
-	if (uri_.size()) {
-        LOG_DBUG("uri_:%s", uri_.c_str());
-		return &uri_;
+	if (token.view_.empty()) {
+		token.view_ = StrView(at, length);
+		return;
+	}
+	// The bytes read later are appended behind in the same buffer
+	if (!token.spill_ && token.view_.data() + token.view_.size() == at) {
+		token.view_ = StrView(token.view_.data(), token.view_.size() + length);
+		return;
 	}
 
-	return NULL;
+	// The pieces are not contiguous, they are joined by copying
+	if (!token.spill_) {
+		spills_.push_back(token.view_.to_string());
+		token.spill_ = &spills_.back();
+	}
+	token.spill_->append(at, length);
+	token.view_ = StrView(*token.spill_);
 }
 
-const string* HTTPRequestImpl::get_http_header(const string & header_name)
+void HTTPRequestImpl::append_body(const char *at, size_t length)
 {
-	string lower_name = header_name;
+	if (streaming_) {
+		body_pieces_.push_back(StrView(at, length));
+	} else {
+		append_token(body_, at, length);
+	}
+}
+
+uint64_t HTTPRequestImpl::release_parsed(void)
+{
+	if (!head_released_) {
+		// The spilled tokens own their bytes already
+		auto copy = [this](Token &token) {
+			if (!token.spill_) {
+				head_copy_.append(token.view_.data(), token.view_.size());
+			}
+		};
+		// Point to the copy after all are appended, the string may be moved by appending
+		size_t offset = 0;
+		auto rebase = [this, &offset](Token &token) {
+			if (!token.spill_) {
+				token.view_ = StrView(head_copy_.data() + offset, token.view_.size());
+				offset += token.view_.size();
+			}
+		};
+
+		copy(uri_);
+		for (auto it = headers_.begin(); it != headers_.end(); ++it) {
+			copy(it->field_);
+			copy(it->value_);
+		}
+		rebase(uri_);
+		for (auto it = headers_.begin(); it != headers_.end(); ++it) {
+			rebase(it->field_);
+			rebase(it->value_);
+		}
+		head_released_ = true;
+	}
+
+	uint64_t bytes = parsed_bytes_;
+
+	parsed_bytes_ = 0;
+	return bytes;
+}
+
+HTTPHeaderId HTTPRequestImpl::index_header(uint32_t index)
+{
+	HTTPHeaderId id = get_http_header_id(headers_[index].field_.view_);
+
+	// The first one wins like the lookup by name
+	if (id != HTTP_HEADER_UNKNOWN && known_headers_[id] == HTTP_HEADER_NONE && index < HTTP_HEADER_NONE) {
+		known_headers_[id] = index;
+	}
+	return id;
+}
+
+uint32_t HTTPRequestImpl::find_header(const StrView &header_name) const
+{
+	HTTPHeaderId id = get_http_header_id(header_name);
+
+	if (id != HTTP_HEADER_UNKNOWN) {
+		return known_headers_[id];
+	}
+	for (uint32_t i = 0; i < headers_.size(); ++i) {
+		if (headers_[i].field_.view_.equal_nocase(header_name)) {
+			return i;
+		}
+	}
 
-	StrToLower(lower_name);
+	return HTTP_HEADER_NONE;
+}
+
+StrView HTTPRequestImpl::get_header_view(const StrView &header_name) const
+{
+	uint32_t index = find_header(header_name);
+
+	return index == HTTP_HEADER_NONE ? StrView() : headers_[index].value_.view_;
+}
 
-	auto it = headers_.find(lower_name);
-	if (it != headers_.end()) {
-		return &it->second;
+const string *HTTPRequestImpl::get_uri(void)
+{
+	if (uri_.view_.size()) {
+		uri_str_.assign(uri_.view_.data(), uri_.view_.size());
+        LOG_DBUG("uri_:%s", uri_str_.c_str());
+		return &uri_str_;
 	}
 
 	return NULL;
 }
 
+const string* HTTPRequestImpl::get_http_header(const StrView &header_name)
+{
+	uint32_t index = find_header(header_name);
+
+	if (index == HTTP_HEADER_NONE) {
+		return NULL;
+	}
+
+	// The spilled value is a string already, the others are copied into spills_ once
+	Token &value = headers_[index].value_;
+	if (!value.spill_) {
+		spills_.push_back(value.view_.to_string());
+		value.spill_ = &spills_.back();
+		value.view_ = StrView(*value.spill_);
+	}
+	return value.spill_;
+}
+
 const string *HTTPRequestImpl::get_body(void)
 {
-	if (body_.size()) {
-		return &body_;
+	if (body_.view_.size()) {
+		body_str_.assign(body_.view_.data(), body_.view_.size());
+		return &body_str_;
 	}
 
 	return NULL;
@@ -310,11 +680,28 @@ const string *HTTPRequestImpl::get_body(void)
 void HTTPRequestImpl::clear()
 {
 	http_parser_init(&parser_, HTTP_REQUEST);
+	parsed_bytes_ = 0;
 	is_completed_ = false;
-	uri_.clear();
-	header_field_.clear();
+	head_scanned_ = 0;
+	head_line_ = 0;
+	head_parsed_ = false;
+	chunked_ = false;
+	body_left_ = 0;
+	chunked_decoder_.reset();
+	uri_ = Token();
 	headers_.clear();
-	body_.clear();
+	memset(known_headers_, 0xff, sizeof(known_headers_));
+	in_value_ = false;
+	body_ = Token();
+	spills_.clear();
+	headers_done_ = false;
+	headers_notified_ = false;
+	body_pieces_.clear();
+	head_released_ = false;
+	head_copy_.clear();
+	context_.reset();
+	uri_str_.clear();
+	body_str_.clear();
 }
 
 };
@@ -1,10 +1,12 @@
 #include "base/server/task_server.hpp"
 #include "base/utils/ik_logger.h"
 #include "base/utils/compiler.hpp"
+#include "base/utils/timestamp.hpp"
 
 #include <signal.h>
 #include <string.h>
 #include <sys/signalfd.h>
+#include <sys/eventfd.h>
 
 #include <iostream>
 #include <vector>
@@ -15,6 +17,12 @@ namespace cppbase {
 
 bool TCPServer::init(void)
 {
+	// sendfile has no MSG_NOSIGNAL, ignore SIGPIPE unless the user handles it
+	struct sigaction sa;
+	if (!signals_.count(SIGPIPE) && sigaction(SIGPIPE, NULL, &sa) == 0 && sa.sa_handler == SIG_DFL) {
+		signal(SIGPIPE, SIG_IGN);
+	}
+
 	if (!lsock_.open(AF_INET, SOCK_STREAM, 0, Socket::SOCKET_REUSEADDR_BIT|Socket::SOCKET_REUSEPORT_BIT|Socket::SOCKET_NONBLOCK_BIT)) {
 		cerr << "TCPServer fail to open socket" << endl;
 		return false;
@@ -25,7 +33,12 @@ bool TCPServer::init(void)
 		return false;
 	}
 	
-	if (!lsock_.listen(5)) {
+	if (defer_accept_secs_ && !lsock_.set_defer_accept(defer_accept_secs_)) {
+		cerr << "TCPServer fail to set TCP_DEFER_ACCEPT" << endl;
+		return false;
+	}
+
+	if (!lsock_.listen(backlog_)) {
 		cerr << "TCPServer fail to listen port(" << port_ << ")" << endl;
 		return false;
 	}
@@ -34,8 +47,22 @@ bool TCPServer::init(void)
 		cerr << "TCPServer fail to init epoll" << endl;
 		return false;
 	}
+
+	task_fd_ = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if (-1 == task_fd_ || !epoll_.epoll_add_handler(task_fd_, &task_handler_, EventPoll::EPOLL_EPOLLIN)) {
+		cerr << "TCPServer fail to create task eventfd" << endl;
+		return false;
+	}
 	
-	if (!epoll_.epoll_add_fd(lsock_.sock_, EventPoll::EPOLL_EPOLLIN)) {
+	if (io_backend_ == IO_BACKEND_URING) {
+		if (init_uring()) {
+			return true;
+		}
+		cerr << "TCPServer falls back to epoll" << endl;
+		io_backend_ = IO_BACKEND_EPOLL;
+	}
+
+	if (!epoll_.epoll_add_handler(lsock_.sock_, &accept_handler_, EventPoll::EPOLL_EPOLLIN)) {
 		cerr << "Fail to add fd into epoll" << endl;
 		return false;
 	}
@@ -43,191 +70,571 @@ bool TCPServer::init(void)
 	return true;
 }
 
+bool TCPServer::init_uring(void)
+{
+	if (!uring_.init()) {
+		return false;
+	}
+
+	// The signal and timer fds are still monitored by epoll, and the epoll fd is polled by io_uring
+	if (!uring_.prep_accept_multishot(lsock_.sock_, SOCK_CLOEXEC, URING_OP_ACCEPT) ||
+		!uring_.prep_poll_multishot(epoll_.get_fd(), EPOLLIN, URING_OP_POLL)) {
+		cerr << "Fail to prepare io_uring requests" << endl;
+		return false;
+	}
+
+	return true;
+}
+
 void TCPServer::start(void * data) throw (Errno)
 {	
-	vector<EventPoll::EPEvent> ready_fds;
-	uint32_t ready_cnt;
-	bool recv_signal = false;
-	bool recv_timer = false;
-	OneshotTimerPtr oneshot_timer;
-
 	create_signal_fd();
 
 	create_timer_fd();
+
+	loop_thread_ = pthread_self();
+	loop_running_.store(true, std::memory_order_release);
+	if (idle_timeout_nsecs_) {
+		timer_wheel_.add_timer([this](void *) { sweep_idle_conns(); }, idle_timeout_nsecs_, NULL,
+			TimeStamp::get_monotonic_nsecs());
+	}
+
+	// The tasks may be posted before init, the eventfd didn't exist then
+	task_wakeup_.store(false);
+	if (!tasks_.empty()) {
+		wakeup_loop();
+	}
 	
 	while (!exit()) {
-		ready_cnt = epoll_.epoll_wait(ready_fds, 1);
-		if (!ready_cnt) {
+		uint32_t ready_cnt;
+		int64_t wait_nsecs = next_loop_wait_nsecs();
+
+		if (io_backend_ == IO_BACKEND_URING) {
+			ready_cnt = uring_dispatch(wait_nsecs);
+		} else {
+			ready_cnt = epoll_.epoll_dispatch_ns(wait_nsecs);
+		}
+
+		closed_conns_.clear();
+		// The deadline may pass without any ready event
+		process_oneshot_timers();
+		if (!ready_cnt && ready_conns_.empty()) {
             // LOG_TRAC("no epoll wait event");
+			flush_write_conns();
 			continue;
 		}
-		
-		for (uint32_t i = 0; i < ready_cnt; ++i) {
-			if (ready_fds[i].events_ & EventPoll::EPOLL_EPOLLOUT) {
-				conn_write_data(ready_fds[i].fd_);
-			} else {				
-				if (ready_fds[i].fd_ == lsock_.sock_) {
-					accept_new_conn();
-				} else if (ready_fds[i].fd_ == sig_fd_) {
-					recv_signal = true;
-                    LOG_TRAC("recv_signal = true");
-				} else if (period_timer_ && ready_fds[i].fd_ == period_timer_->get_fd()) {
-					recv_timer = true;
-                    LOG_TRAC("recv_timer = true");
-				} else if ((oneshot_timer = find_oneshot_timer(ready_fds[i].fd_))) {
-					process_oneshot_timer(oneshot_timer);
-					oneshot_timer.reset();
-				} else {
-					conn_read_data(ready_fds[i].fd_);
-				}
-			}		
-		}
 
-		if (recv_signal) {
-			recv_signal = false;
+		if (recv_signal_) {
+			recv_signal_ = false;
 			process_signals();
 		}
 
-		if (likely(msg_cb_)) {
+		if (recv_task_) {
+			recv_task_ = false;
+			process_tasks();
+		}
+
+		if (offload_msg_cb_) {
+			offload_msgs();
+		} else if (likely(msg_cb_)) {
 			process_msgs();
 		}
 
-		if (recv_timer) {
-			recv_timer = false;
+		if (recv_timer_) {
+			recv_timer_ = false;
 			process_timer();
 		}
+
+		flush_write_conns();
 	}
+
+	loop_running_.store(false, std::memory_order_release);
 }
 
-void TCPServer::add_oneshot_timer(const OneshotTimerCallback & cb, uint64_t nsecs, void * data) throw (Errno)
+OneshotTimerId TCPServer::add_oneshot_timer(const OneshotTimerCallback & cb, uint64_t nsecs, void * data) throw (Errno)
 {
-    LOG_TRAC("begin");
-	OneshotTimerPtr timer = make_shared<OneshotTimer> (nsecs);
-	timer->cb_ = cb;
-	timer->data_ = data;
+	return timer_wheel_.add_timer(cb, nsecs, data, TimeStamp::get_monotonic_nsecs());
+}
+
+int64_t TCPServer::next_loop_wait_nsecs(void) const
+{
+	// The conns with the left messages are processed without waiting
+	if (!ready_conns_.empty()) {
+		return 0;
+	}
 
-	timer->timerfd_->start();
+	int64_t wait_nsecs = timer_wheel_.next_timeout_nsecs(TimeStamp::get_monotonic_nsecs());
 
-	if (!epoll_.epoll_add_fd(timer->timerfd_->get_fd(), EventPoll::EPOLL_EPOLLIN)) {
-		throw Errno("Fail to add one-shot timer fd");
+	if (wait_nsecs < 0 || wait_nsecs > LOOP_MAX_WAIT_NSECS) {
+		return LOOP_MAX_WAIT_NSECS;
 	}
+	return wait_nsecs;
+}
 
-	oneshot_timers_.insert(make_pair(timer->timerfd_->get_fd(), timer));
-    LOG_TRAC("end");
+uint32_t TCPServer::conn_epoll_flags(bool wait_write, bool read_paused) const
+{
+	if (edge_triggered_) {
+		return EventPoll::EPOLL_EPOLLIN | EventPoll::EPOLL_EPOLLOUT | EventPoll::EPOLL_EPOLLRDHUP | EventPoll::EPOLL_EPOLLET;
+	}
+
+	// The level triggered readiness would be reported again and again if it isn't read.
+	// The paused conn keeps EPOLLRDHUP, EventPoll refuses the empty flags.
+	if (read_paused) {
+		return wait_write ? EventPoll::EPOLL_EPOLLOUT : EventPoll::EPOLL_EPOLLRDHUP;
+	}
+	if (wait_write) {
+		return EventPoll::EPOLL_EPOLLIN | EventPoll::EPOLL_EPOLLOUT;
+	}
+	return EventPoll::EPOLL_EPOLLIN | EventPoll::EPOLL_EPOLLRDHUP;
 }
 
 void TCPServer::accept_new_conn(void)
 {
     LOG_TRAC("begin");
-	struct sockaddr addr;
-	socklen_t addrlen = sizeof(addr);
-	
-	int fd = accept4(lsock_.sock_, &addr, &addrlen, SOCK_CLOEXEC);
-	if (-1 != fd) { 
-		if (!epoll_.epoll_add_fd(fd, EventPoll::EPOLL_EPOLLIN)) {
-			LOG_ERRO("Failed to insert new fd into epoll");
-			close(fd);
+	// Drain the accept queue in burst, the listen socket is level triggered so the left ones are not lost
+	for (uint32_t i = 0; i < accept_budget_; ++i) {
+		struct sockaddr addr;
+		socklen_t addrlen = sizeof(addr);
+
+		int fd = accept4(lsock_.sock_, &addr, &addrlen, SOCK_CLOEXEC|SOCK_NONBLOCK);
+		if (-1 == fd) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				LOG_ERRO("Invalid fd(%d) returned by accept, %s", fd, strerror(errno));
+			}
+			break;
+		}
+		setup_new_conn(fd, addr, addrlen);
+	}
+    LOG_TRAC("end");
+}
+
+void TCPServer::setup_new_conn(int fd, const struct sockaddr &addr, socklen_t addrlen)
+{
+	if (max_conns_ && conn_cnt_ >= max_conns_) {
+		LOG_ERRO("Reach the max conns(%u), reject the new conn", max_conns_);
+		close(fd);
+		return;
+	}
+
+	shared_ptr<ServerConn> server_conn = make_shared<ServerConn>(this, fd);
+
+	if (io_backend_ == IO_BACKEND_URING) {
+		uint64_t user_data = reinterpret_cast<uint64_t>(server_conn.get()) | URING_OP_RECV;
+
+		if (!uring_.prep_recv_multishot(fd, user_data)) {
+			LOG_ERRO("Failed to prepare io_uring recv");
 			return;
 		}
-		
-		ConnPtr conn = make_shared<Conn>(fd);
-		conn->set_peer_info(Peer::PEER_AF_INET, addr, addrlen);
-		conns_[fd] = conn;
+		server_conn->uring_ops_++;
+	} else if (!epoll_.epoll_add_handler(fd, server_conn.get(), conn_epoll_flags(false))) {
+		LOG_ERRO("Failed to insert new fd into epoll");
+		return;
+	} else if (zerocopy_threshold_) {
+		server_conn->set_zerocopy_threshold(zerocopy_threshold_);
+	}
 	
-        LOG_INFO("new conn arrived from: %s", conn->to_str());
-		if (conn_cb_) {
-			LOG_TRAC("conn_cb_ begin");
-			conn_cb_(conn, CONN_CONNECTED);
-			LOG_TRAC("conn_cb_ end");
-			if (conn->is_force_close()) {
-				close_conn(conn);
-			} else {
-				if (!conn->send_buf_empty() || conn->is_local_fin()) {
-					add_conn_wait_write(conn);
-				}
+	ConnPtr conn = server_conn;
+	conn->set_peer_info(Peer::PEER_AF_INET, addr, addrlen);
+	conn->set_send_watermarks(send_high_watermark_, send_low_watermark_);
+	if (static_cast<size_t>(fd) >= conns_.size()) {
+		conns_.resize(fd + 1);
+	}
+	conns_[fd] = conn;
+	conn_cnt_++;
+	touch_conn(conn);
+
+    LOG_INFO("new conn arrived from: %s", conn->to_str());
+	if (conn_cb_) {
+		LOG_TRAC("conn_cb_ begin");
+		conn_cb_(conn, CONN_CONNECTED);
+		LOG_TRAC("conn_cb_ end");
+		if (conn->is_force_close()) {
+			close_conn(conn);
+		} else {
+			if (!conn->send_buf_empty() || conn->is_local_fin()) {
+				add_conn_wait_write(conn);
 			}
+			check_send_watermark(conn);
 		}
+	}
+}
+
+void TCPServer::signal_ready(void)
+{
+	recv_signal_ = true;
+	LOG_TRAC("recv_signal = true");
+}
+
+void TCPServer::timer_ready(void)
+{
+	recv_timer_ = true;
+	LOG_TRAC("recv_timer = true");
+}
+
+void TCPServer::task_ready(void)
+{
+	recv_task_ = true;
+}
+
+void TCPServer::post(const LoopTask &task)
+{
+	tasks_.push(task);
+	wakeup_loop();
+}
+
+void TCPServer::post(LoopTask &&task)
+{
+	tasks_.push(std::move(task));
+	wakeup_loop();
+}
+
+void TCPServer::run_in_loop(const LoopTask &task)
+{
+	if (in_loop_thread()) {
+		task();
 	} else {
-		LOG_ERRO("Invalid fd(%d) returned by accept, %s", fd, strerror(errno));
-        return;
+		post(task);
 	}
-    LOG_TRAC("end");
 }
 
-void TCPServer::conn_read_data(int fd)
+void TCPServer::wakeup_loop(void)
 {
-    LOG_TRAC("begin");
-	auto fd_conn = conns_.find(fd);
-	if (fd_conn == conns_.end()) {
-		LOG_ERRO("No connresponding conn");
+	// Only the first poster after the loop drains the queue writes the eventfd
+	if (!task_wakeup_.exchange(true) && task_fd_ != -1) {
+		uint64_t one = 1;
+
+		if (write(task_fd_, &one, sizeof(one)) != sizeof(one)) {
+			LOG_ERRO("Fail to wake up the loop: %s", strerror(errno));
+		}
+	}
+}
+
+void TCPServer::process_tasks(void)
+{
+	uint64_t cnt;
+	LoopTask task;
+
+	if (read(task_fd_, &cnt, sizeof(cnt)) == -1 && errno != EAGAIN) {
+		LOG_ERRO("Fail to read task eventfd: %s", strerror(errno));
+	}
+	// Clear it before draining, the task posted after it wakes up the loop again
+	task_wakeup_.store(false);
+
+	for (uint32_t i = 0; i < LOOP_TASK_BUDGET; ++i) {
+		if (!tasks_.pop(task)) {
+			return;
+		}
+		task();
+	}
+
+	if (!tasks_.empty()) {
+		wakeup_loop();
+	}
+}
+
+void TCPServer::update_conn(const ConnPtr &conn)
+{
+	if (conn->get_fd() == -1) {
 		return;
 	}
-	
-	ConnPtr conn = fd_conn->second;
-	
-	bool empty = conn->rcv_buf_empty();
-	
-	if (!conn->read_bytes()) {
+
+	if (conn->is_force_close()) {
+		ConnPtr closed = conn;
+		close_conn(closed);
+	} else {
+		if (!conn->send_buf_empty() || conn->is_local_fin()) {
+			add_conn_wait_write(conn);
+		}
+		check_send_watermark(conn);
+	}
+}
+
+void TCPServer::conn_handle_events(ServerConn *server_conn, uint32_t events)
+{
+	if (server_conn->get_fd() == -1) {
+		// The conn is closed by the former event in the same round
+		return;
+	}
+
+	ConnPtr conn = server_conn->shared_from_this();
+
+	// The zero copy completions are queued in the error queue
+	bool zerocopy_wakeup = (events & EPOLLERR) && conn->zerocopy_pending();
+
+	if (zerocopy_wakeup) {
+		conn->reap_zerocopy();
+		if (!conn->zerocopy_pending() && conn->is_local_fin() && conn->send_buf_empty()) {
+			close_conn(conn);
+			return;
+		}
+	}
+
+	if (events & EPOLLOUT) {
+		conn_write_data(conn);
+		if (conn->get_fd() == -1) {
+			return;
+		}
+		if (!edge_triggered_ && !(events & (EPOLLIN|EPOLLERR|EPOLLHUP))) {
+			return;
+		}
+	}
+
+	if (!server_conn->read_paused_) {
+		if (events & (EPOLLIN|EPOLLRDHUP|EPOLLERR|EPOLLHUP)) {
+			conn_read_data(conn);
+		}
+	} else if ((events & EPOLLRDHUP) || ((events & (EPOLLERR|EPOLLHUP)) && !zerocopy_wakeup)) {
+		// The paused conn is still read for the fin and the error, otherwise they would be reported again and again.
+		// The wakeup of the zero copy completions is not an error.
+		conn_read_data(conn);
+	}
+}
+
+void TCPServer::conn_read_data(const ConnPtr &conn)
+{
+    LOG_TRAC("begin");
+	uint32_t total = 0;
+	ssize_t bytes;
+
+	// Read until EAGAIN or the budget is used up, the short read means no more data in LT mode
+	while (true) {
+		uint32_t size = Conn::CONN_DEFAULT_READ_BYTES;
+
+		if (read_by_fionread_) {
+			int avail = conn->get_readable_bytes();
+			if (avail > 0) {
+				size = avail;
+			}
+		}
+		size = min(size, read_budget_ - total);
+
+		bytes = conn->read_bytes(size);
+		if (bytes <= 0) {
+			break;
+		}
+		total += bytes;
+		if (total >= read_budget_ || (!edge_triggered_ && static_cast<uint32_t>(bytes) < size)) {
+			break;
+		}
+	}
+	// The idle conn keeps no unfilled buffer
+	conn->get_msg_buf()->release_spare_bufs();
+
+	if (bytes == 0 || (bytes == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
 		LOG_INFO("Disconnect the conn: %s", conn->to_str());
 		if (likely(conn_cb_)) {
 			LOG_TRAC("conn_cb_ begin");
 			conn_cb_(conn, CONN_DISCONNECTED);
 			LOG_TRAC("conn_cb_ end");
 		}
-		close_conn(conn);
+		ConnPtr closed = conn;
+		close_conn(closed);
 		return;
 	}
 	
-	if (empty) {
+	if (edge_triggered_ && bytes > 0 && !static_cast<ServerConn*>(conn.get())->read_paused_) {
+		// The budget is used up before EAGAIN, modifying it brings a new edge for the left bytes
+		epoll_.epoll_modify_handler(conn->get_fd(), static_cast<ServerConn*>(conn.get()), conn_epoll_flags(false));
+	}
+
+	touch_conn(conn);
+	// The conn waiting for the rest of a message is ready again with the new bytes
+	if (total && !conn->ready_node().linked() && !static_cast<ServerConn*>(conn.get())->read_paused_) {
 		LOG_DBUG("The conn is ready to read: %s", conn->to_str());
-		wait_read_conns_.insert(conn);
+		conn->ready_node().add_tail(&ready_conns_);
 	}
     LOG_TRAC("end");
 }
 
-void TCPServer::conn_write_data(int fd)
+void TCPServer::conn_write_data(const ConnPtr &conn)
 {
     LOG_TRAC("begin");
-	auto fd_conn = conns_.find(fd);
-	if (fd_conn == conns_.end()) {
-		LOG_ERRO("No connresponding conn");
-		return;
-	}
-	
-	ConnPtr conn = fd_conn->second;
 	conn->send_bytes();
-	
+	touch_conn(conn);
+	conn_write_finished(conn);
+
+    LOG_TRAC("end");
+}
+
+void TCPServer::conn_write_finished(const ConnPtr &conn)
+{
+	// Resume before the write wait is removed, so the paused conn never drops to the bare EPOLLRDHUP
+	if (static_cast<ServerConn*>(conn.get())->read_paused_ && conn->below_send_low_watermark()) {
+		resume_conn_read(conn);
+		if (conn->get_fd() == -1) {
+			return;
+		}
+	}
+
 	if (conn->send_buf_empty()) {
 		remove_conn_wait_write(conn);
 		
-		// grace close
-		if (conn->is_local_fin()) {
-			close_conn(conn);
+		// grace close, wait for the kernel to release the zero copy slices
+		if (conn->get_fd() != -1 && conn->is_local_fin() && !conn->zerocopy_pending()) {
+			ConnPtr closed = conn;
+			close_conn(closed);
 		}
 	} else {
 		if (conn->is_force_close()) {
+			ConnPtr closed = conn;
+			close_conn(closed);
+		}
+	}
+}
+
+void TCPServer::check_send_watermark(const ConnPtr &conn)
+{
+	ServerConn *server_conn = static_cast<ServerConn*>(conn.get());
+
+	if (server_conn->read_paused_ || !conn->above_send_high_watermark()) {
+		return;
+	}
+
+	LOG_DBUG("conn(%s) reaches the send high watermark, stop reading it", conn->to_str());
+	server_conn->read_paused_ = true;
+	// The received messages are not handled either, they may bring more replies
+	conn->ready_node().del();
+	if (io_backend_ == IO_BACKEND_URING) {
+		uring_.prep_cancel(reinterpret_cast<uint64_t>(server_conn) | URING_OP_RECV, URING_OP_CANCEL);
+	} else if (!edge_triggered_) {
+		epoll_.epoll_modify_handler(conn->get_fd(), server_conn, conn_epoll_flags(server_conn->wait_epollout_, true));
+	}
+
+	if (watermark_cb_) {
+		watermark_cb_(conn, SEND_HIGH_WATERMARK);
+	}
+}
+
+void TCPServer::resume_conn_read(const ConnPtr &conn)
+{
+	ServerConn *server_conn = static_cast<ServerConn*>(conn.get());
+
+	LOG_DBUG("conn(%s) drops to the send low watermark, read it again", conn->to_str());
+	server_conn->read_paused_ = false;
+	if (io_backend_ == IO_BACKEND_URING) {
+		if (server_conn->uring_recv_stopped_) {
+			uint64_t user_data = reinterpret_cast<uint64_t>(server_conn) | URING_OP_RECV;
+
+			if (uring_.prep_recv_multishot(conn->get_fd(), user_data)) {
+				server_conn->uring_ops_++;
+				server_conn->uring_recv_stopped_ = false;
+			}
+		}
+	} else {
+		// Modifying it brings a new edge for the bytes arrived in the pause
+		epoll_.epoll_modify_handler(conn->get_fd(), server_conn, conn_epoll_flags(server_conn->wait_epollout_));
+	}
+	if (!conn->rcv_buf_empty() && !conn->ready_node().linked()) {
+		conn->ready_node().add_tail(&ready_conns_);
+	}
+
+	if (watermark_cb_) {
+		watermark_cb_(conn, SEND_LOW_WATERMARK);
+		update_conn(conn);
+	}
+}
+
+void TCPServer::release_conn(const ConnPtr &conn)
+{
+	int fd = conn->get_fd();
+
+	if (io_backend_ == IO_BACKEND_URING) {
+		ServerConn *server_conn = static_cast<ServerConn*>(conn.get());
+
+		if (server_conn->uring_ops_) {
+			// Hold the conn until all its requests complete
+			uring_.prep_cancel(reinterpret_cast<uint64_t>(server_conn) | URING_OP_RECV, URING_OP_CANCEL);
+			server_conn->uring_hold_ = conn;
+		}
+	} else {
+		epoll_.epoll_del_fd(fd);
+	}
+	conn->ready_node().del();
+	conn->write_node().del();
+	static_cast<ServerConn*>(conn.get())->lru_node_.del();
+	// The handler may be referred by the pending ready events
+	closed_conns_.push_back(conn);
+	conn->close();
+
+	conns_[fd].reset();
+	conn_cnt_--;
+}
+
+void TCPServer::touch_conn(const ConnPtr &conn)
+{
+	if (!idle_timeout_nsecs_) {
+		return;
+	}
+
+	ServerConn *server_conn = static_cast<ServerConn*>(conn.get());
+
+	server_conn->last_active_nsecs_ = TimeStamp::get_monotonic_nsecs();
+	server_conn->lru_node_.move_tail(&lru_conns_);
+}
+
+void TCPServer::sweep_idle_conns(void)
+{
+	uint64_t now = TimeStamp::get_monotonic_nsecs();
+
+	// Only the head of LRU needs to be checked
+	while (!lru_conns_.empty()) {
+		ServerConn *server_conn = lru_conns_.first_owner();
+
+		if (server_conn->last_active_nsecs_ + idle_timeout_nsecs_ > now) {
+			break;
+		}
+
+		ConnPtr conn = server_conn->shared_from_this();
+
+		LOG_INFO("Close the idle conn: %s", conn->to_str());
+		server_conn->lru_node_.del();
+		conn->force_close();
+		if (conn_cb_) {
+			LOG_TRAC("conn_cb_ begin");
+			conn_cb_(conn, CONN_DISCONNECTED);
+			LOG_TRAC("conn_cb_ end");
+		}
+		if (conn->get_fd() != -1) {
 			close_conn(conn);
 		}
 	}
 
-    LOG_TRAC("end");
+	// Wake up when the head expires
+	uint64_t delay = idle_timeout_nsecs_;
+	if (!lru_conns_.empty()) {
+		delay = lru_conns_.first_owner()->last_active_nsecs_ + idle_timeout_nsecs_ - now;
+	}
+	timer_wheel_.add_timer([this](void *) { sweep_idle_conns(); }, delay, NULL, now);
 }
 
 void TCPServer::process_msgs(void)
 {	
     LOG_TRAC("begin");
-	for (auto it = wait_read_conns_.begin(); it != wait_read_conns_.end();) {
-		ConnPtr conn = *it;
+	ListNode<Conn> ready;
+
+	// The callback may close any conn, it is unlinked from the local list then
+	ready_conns_.splice_tail(&ready);
+	while (!ready.empty()) {
+		ConnPtr conn = ready.first_owner()->shared_from_this();
 		bool send_empty = conn->send_buf_empty();
+		uint64_t rcv_bytes = conn->get_msg_buf()->total_size();
 
+		conn->ready_node().del();
 		LOG_TRAC("msg_cb_ begin");
 		msg_cb_(conn, conn->get_msg_buf());
 		LOG_TRAC("msg_cb_ end");
+		if (conn->get_fd() == -1) {
+			// Closed by the callback
+			continue;
+		}
 		if (conn->rcv_buf_empty()) {
             LOG_DBUG("The conn is removed from ready_conns: %s", conn->to_str());
-			it = wait_read_conns_.erase(it);
-		} else {
-			++it;
+		} else if (conn->get_msg_buf()->total_size() < rcv_bytes && !conn->ready_node().linked()) {
+			// The left bytes may hold more messages, the conn waits for more bytes if nothing is consumed
+			conn->ready_node().add_tail(&ready_conns_);
 		}
 	
 		if (conn->is_force_close()) {
@@ -236,11 +643,107 @@ void TCPServer::process_msgs(void)
 			if ((!conn->send_buf_empty() && send_empty) || conn->is_local_fin()) {
 				add_conn_wait_write(conn);
 			}
+			check_send_watermark(conn);
 		}
 	}
     LOG_TRAC("end");
 }
 
+void TCPServer::set_frame_callback(const FrameCodecPtr &codec, const FrameCallback &cb)
+{
+	frame_codec_ = codec;
+	frame_cb_ = cb;
+	msg_cb_ = std::bind(&TCPServer::process_frames, this, std::placeholders::_1, std::placeholders::_2);
+}
+
+void TCPServer::process_frames(const ConnPtr &conn, PacketBufPtr &msg)
+{
+	ServerConn *server_conn = static_cast<ServerConn*>(conn.get());
+
+	while (!msg->empty()) {
+		FrameCodec::FrameRange range;
+		FrameCodec::DecodeResult ret = frame_codec_->decode(*msg, server_conn->frame_scanned_, range);
+
+		if (ret == FrameCodec::FRAME_DECODE_MORE) {
+			break;
+		} else if (ret == FrameCodec::FRAME_DECODE_ERROR) {
+			LOG_WARN("conn(%s) receives an invalid frame", conn->to_str());
+			conn->force_close();
+			break;
+		}
+
+		frame_.header_ = range.header_bytes_ ? msg->linearize(range.header_bytes_) : NULL;
+		frame_.header_size_ = range.header_bytes_;
+		frame_.payload_.clear();
+		msg->peek_range_iov(range.header_bytes_, range.payload_bytes_, frame_.payload_);
+		frame_.payload_size_ = range.payload_bytes_;
+
+		frame_cb_(conn, frame_);
+		server_conn->frame_scanned_ = 0;
+		if (conn->get_fd() == -1 || conn->is_force_close()) {
+			break;
+		}
+		msg->consume_bytes(range.header_bytes_ + range.payload_bytes_ + range.trailer_bytes_);
+		// The left frames are handled after the replies drop to the low watermark
+		if (conn->above_send_high_watermark()) {
+			break;
+		}
+	}
+}
+
+void TCPServer::offload_msgs(void)
+{
+	while (!ready_conns_.empty()) {
+		ConnPtr conn = ready_conns_.first_owner()->shared_from_this();
+		PacketBufPtr msg = make_shared<PacketBuf>();
+
+		conn->ready_node().del();
+		// Hand over the received bytes, the loop keeps reading into the new buffer
+		msg.swap(conn->get_msg_buf());
+		worker_pool_->dispatch(conn->get_fd(), [this, conn, msg]() {
+			offload_msg_handle(conn, msg);
+		});
+	}
+}
+
+void TCPServer::offload_msg_handle(const ConnPtr &conn, const PacketBufPtr &msg)
+{
+	// It is run by the worker thread
+	PacketBufPtr &pending = static_cast<ServerConn*>(conn.get())->offload_msg_;
+
+	if (!pending || pending->empty()) {
+		pending = msg;
+	} else {
+		pending->append_packet(*msg);
+	}
+
+	PacketBufPtr reply = make_shared<PacketBuf>();
+	bool keep = offload_msg_cb_(conn, pending, *reply);
+
+	// The completion is run by the loop thread, after the former ones of the worker
+	post([this, conn, reply, keep]() mutable {
+		offload_msg_done(conn, reply, keep);
+	});
+}
+
+void TCPServer::offload_msg_done(const ConnPtr &conn, PacketBufPtr &reply, bool keep)
+{
+	if (conn->get_fd() == -1) {
+		return;
+	}
+
+	if (conn->send_buf_empty()) {
+		conn->get_send_buf().swap(reply);
+	} else {
+		conn->get_send_buf()->append_packet(*reply);
+	}
+
+	if (!keep) {
+		conn->grace_close();
+	}
+	update_conn(conn);
+}
+
 void TCPServer::create_signal_fd(void) throw (Errno)
 {
     LOG_TRAC("begin");
@@ -268,7 +771,7 @@ void TCPServer::create_signal_fd(void) throw (Errno)
 			throw Errno("Fail to signalfd");
 		}
 
-		if (!epoll_.epoll_add_fd(sig_fd_, EventPoll::EPOLL_EPOLLIN)) {
+		if (!epoll_.epoll_add_handler(sig_fd_, &signal_handler_, EventPoll::EPOLL_EPOLLIN)) {
 			throw Errno("Fail to add signal fd");
 		}
 	}
@@ -304,7 +807,7 @@ void TCPServer::create_timer_fd(void) throw (Errno)
 		period_timer_->start();
 		// LOG_INFO << "Period timer is set successfully" << endl;
 		
-		if (!epoll_.epoll_add_fd(period_timer_->get_fd(), EventPoll::EPOLL_EPOLLIN)) {
+		if (!epoll_.epoll_add_handler(period_timer_->get_fd(), &timer_handler_, EventPoll::EPOLL_EPOLLIN)) {
 			throw Errno("Fail to add timer fd");
 		}
 		// LOG_INFO << "Period timer starts" << endl;
@@ -323,45 +826,251 @@ void TCPServer::process_timer(void) throw (Errno)
     LOG_TRAC("end");
 }
 
-TCPServer::OneshotTimerPtr TCPServer::find_oneshot_timer(int fd) const
+void TCPServer::process_oneshot_timers(void)
+{
+	if (timer_wheel_.size()) {
+		timer_wheel_.run_timers(TimeStamp::get_monotonic_nsecs());
+	}
+}
+
+void TCPServer::add_conn_wait_write(const ConnPtr & conn)
 {
     LOG_TRAC("begin");
-	auto it = oneshot_timers_.find(fd);
+	bool linked = conn->write_node().linked();
 
-	return it == oneshot_timers_.end() ? nullptr: it->second;
+	// The sends are issued by flush_write_conns or uring_flush_sends in the end of the loop,
+	// so the bytes written by several callbacks go out together
+	if (!linked) {
+		conn->write_node().add_tail(&write_conns_);
+	}
     LOG_TRAC("end");
 }
 
-void TCPServer::process_oneshot_timer(TCPServer::OneshotTimerPtr &timer)
+void TCPServer::remove_conn_wait_write(const ConnPtr & conn)
 {
     LOG_TRAC("begin");
-	timer->cb_(timer->data_);
-	oneshot_timers_.erase(timer->timerfd_->get_fd());
-	epoll_.epoll_del_fd(timer->timerfd_->get_fd());
+	ServerConn *server_conn = static_cast<ServerConn*>(conn.get());
+	bool wait_epollout = server_conn->wait_epollout_;
+
+	conn->write_node().del();
+	server_conn->wait_epollout_ = false;
+
+	if (conn->is_remote_fin()) {
+		release_conn(conn);
+	} else if (wait_epollout && !edge_triggered_ && io_backend_ == IO_BACKEND_EPOLL) {
+		epoll_.epoll_modify_handler(conn->get_fd(), server_conn, conn_epoll_flags(false, server_conn->read_paused_));
+	}
     LOG_TRAC("end");
 }
 
-void TCPServer::add_conn_wait_write(const ConnPtr & conn)
+void TCPServer::flush_write_conns(void)
 {
-    LOG_TRAC("begin");
-	wait_write_conns_.insert(conn);
-	epoll_.epoll_modify_fd(conn->get_fd(), EventPoll::EPOLL_EPOLLIN | EventPoll::EPOLL_EPOLLOUT);
-    LOG_TRAC("end");
+	if (io_backend_ == IO_BACKEND_URING) {
+		// uring_dispatch submits them with the next wait
+		return;
+	}
+
+	ListNode<Conn> *pos, *n;
+
+	list_for_each_safe(pos, n, &write_conns_) {
+		ConnPtr conn = pos->owner()->shared_from_this();
+		ServerConn *server_conn = static_cast<ServerConn*>(conn.get());
+
+		if (server_conn->wait_epollout_) {
+			continue;
+		}
+
+		// Write through, most responses fit in the socket buffer and need no EPOLLOUT
+		conn_write_data(conn);
+		if (conn->get_fd() == -1 || !conn->write_node().linked()) {
+			continue;
+		}
+
+		// The socket buffer is full. The ET registration always has EPOLLOUT, the edge comes when it drains
+		server_conn->wait_epollout_ = true;
+		if (!edge_triggered_) {
+			epoll_.epoll_modify_handler(conn->get_fd(), server_conn, conn_epoll_flags(true, server_conn->read_paused_));
+		}
+	}
 }
 
-void TCPServer::remove_conn_wait_write(const ConnPtr & conn)
+uint32_t TCPServer::uring_dispatch(int64_t wait_nsecs)
 {
-    LOG_TRAC("begin");
-	wait_write_conns_.erase(conn);
+	uring_flush_sends();
 
-	if (conn->is_remote_fin()) {
-		epoll_.epoll_del_fd(conn->get_fd());
-		conns_.erase(conn->get_fd());
-		conn->close();
-	} else {
-		epoll_.epoll_modify_fd(conn->get_fd(), EventPoll::EPOLL_EPOLLIN | EventPoll::EPOLL_EPOLLRDHUP);
+	uint32_t cnt = uring_.submit_and_wait(cqes_, wait_nsecs);
+
+	for (uint32_t i = 0; i < cnt; ++i) {
+		const UringPoll::Completion &cqe = cqes_[i];
+		ServerConn *conn = reinterpret_cast<ServerConn*>(cqe.user_data_ & ~static_cast<uint64_t>(URING_OP_MASK));
+
+		switch (cqe.user_data_ & URING_OP_MASK) {
+			case URING_OP_ACCEPT:
+				uring_accept(cqe);
+				break;
+			case URING_OP_POLL:
+				epoll_.epoll_dispatch(0);
+				if (!cqe.more()) {
+					uring_.prep_poll_multishot(epoll_.get_fd(), EPOLLIN, URING_OP_POLL);
+				}
+				break;
+			case URING_OP_RECV:
+				uring_recv(conn, cqe);
+				break;
+			case URING_OP_SEND:
+				uring_send_done(conn, cqe);
+				break;
+			default:
+				break;
+		}
+	}
+
+	return cnt;
+}
+
+void TCPServer::uring_flush_sends(void)
+{
+	ListNode<Conn> *pos, *n;
+
+	list_for_each_safe(pos, n, &write_conns_) {
+		ConnPtr conn = pos->owner()->shared_from_this();
+		ServerConn *server_conn = static_cast<ServerConn*>(conn.get());
+
+		if (server_conn->uring_sending_) {
+			continue;
+		}
+
+		if (conn->send_buf_empty()) {
+			// Only the grace close is waiting
+			conn_write_finished(conn);
+			continue;
+		}
+
+		// There is no sendfile in io_uring, the file range is read in chunks
+		if (!conn->get_send_buf()->read_front_file(ServerConn::URING_FILE_CHUNK_BYTES)) {
+			LOG_ERRO("Fail to read the file for conn(%s), force close it", conn->to_str());
+			conn->force_close();
+			close_conn(conn);
+			continue;
+		}
+
+		if (!server_conn->uring_send_msg_) {
+			server_conn->uring_send_msg_.reset(new ServerConn::UringSendMsg);
+		}
+		ServerConn::UringSendMsg *send_msg = server_conn->uring_send_msg_.get();
+
+		memset(&send_msg->msg_, 0, sizeof(send_msg->msg_));
+		send_msg->msg_.msg_iov = send_msg->iov_;
+		send_msg->msg_.msg_iovlen = conn->get_send_buf()->peek_data_iov(send_msg->iov_, ServerConn::URING_SEND_IOV_MAX);
+
+		uint64_t user_data = reinterpret_cast<uint64_t>(server_conn) | URING_OP_SEND;
+		if (!uring_.prep_sendmsg(conn->get_fd(), &send_msg->msg_, MSG_NOSIGNAL, user_data)) {
+			LOG_ERRO("Fail to prepare io_uring send for conn(%s)", conn->to_str());
+			continue;
+		}
+		server_conn->uring_ops_++;
+		server_conn->uring_sending_ = true;
+	}
+}
+
+void TCPServer::uring_accept(const UringPoll::Completion &cqe)
+{
+	if (!cqe.more()) {
+		uring_.prep_accept_multishot(lsock_.sock_, SOCK_CLOEXEC, URING_OP_ACCEPT);
+	}
+
+	if (cqe.res_ < 0) {
+		LOG_ERRO("Invalid fd returned by accept, %s", strerror(-cqe.res_));
+		return;
+	}
+
+	struct sockaddr addr;
+	socklen_t addrlen = sizeof(addr);
+
+	memset(&addr, 0, sizeof(addr));
+	getpeername(cqe.res_, &addr, &addrlen);
+	setup_new_conn(cqe.res_, addr, addrlen);
+}
+
+void TCPServer::uring_recv(ServerConn *server_conn, const UringPoll::Completion &cqe)
+{
+	bool closed = (server_conn->get_fd() == -1);
+
+	if (cqe.has_buffer()) {
+		if (!closed && cqe.res_ > 0) {
+			server_conn->fill_rcv_bytes(uring_.get_buffer(cqe.buffer_id()), cqe.res_);
+		}
+		uring_.recycle_buffer(cqe.buffer_id());
+	}
+
+	if (!cqe.more()) {
+		uring_op_finished(server_conn);
+	}
+	if (closed) {
+		return;
+	}
+
+	ConnPtr conn = server_conn->shared_from_this();
+
+	// The recv is cancelled by the pause of reading
+	if (cqe.res_ > 0 || cqe.res_ == -ENOBUFS || cqe.res_ == -ECANCELED) {
+		if (cqe.res_ > 0) {
+			touch_conn(conn);
+			if (!conn->ready_node().linked() && !server_conn->read_paused_) {
+				conn->ready_node().add_tail(&ready_conns_);
+			}
+		}
+
+		if (!cqe.more() && server_conn->read_paused_) {
+			server_conn->uring_recv_stopped_ = true;
+		} else if (!cqe.more()) {
+			uint64_t user_data = reinterpret_cast<uint64_t>(server_conn) | URING_OP_RECV;
+
+			if (uring_.prep_recv_multishot(conn->get_fd(), user_data)) {
+				server_conn->uring_ops_++;
+			}
+		}
+		return;
+	}
+
+	LOG_INFO("Disconnect the conn: %s", conn->to_str());
+	if (likely(conn_cb_)) {
+		LOG_TRAC("conn_cb_ begin");
+		conn_cb_(conn, CONN_DISCONNECTED);
+		LOG_TRAC("conn_cb_ end");
+	}
+	close_conn(conn);
+}
+
+void TCPServer::uring_send_done(ServerConn *server_conn, const UringPoll::Completion &cqe)
+{
+	server_conn->uring_sending_ = false;
+	uring_op_finished(server_conn);
+	if (server_conn->get_fd() == -1) {
+		return;
+	}
+
+	ConnPtr conn = server_conn->shared_from_this();
+
+	if (cqe.res_ < 0) {
+		LOG_ERRO("conn(%s) send failed: %s, force close it", conn->to_str(), strerror(-cqe.res_));
+		conn->force_close();
+		close_conn(conn);
+		return;
+	}
+
+	conn->get_send_buf()->consume_bytes(cqe.res_);
+	touch_conn(conn);
+	conn_write_finished(conn);
+}
+
+void TCPServer::uring_op_finished(ServerConn *server_conn)
+{
+	server_conn->uring_ops_--;
+	if (!server_conn->uring_ops_ && server_conn->get_fd() == -1) {
+		// The last reference from io_uring, the conn could be released now
+		closed_conns_.push_back(std::move(server_conn->uring_hold_));
 	}
-    LOG_TRAC("end");
 }
 
 } // namespace cppbase
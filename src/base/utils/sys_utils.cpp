@@ -161,6 +161,10 @@ void SysTimerFd::set_interval(void) throw (Errno)
 
 	timeout.it_value.tv_sec = now.tv_sec + secs;
 	timeout.it_value.tv_nsec = now.tv_nsec + nsecs;
+	if (timeout.it_value.tv_nsec >= 1000000000) {
+		timeout.it_value.tv_sec++;
+		timeout.it_value.tv_nsec -= 1000000000;
+	}
 
 	if (period_) {
 		timeout.it_interval.tv_sec = secs;
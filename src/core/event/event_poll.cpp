@@ -1,6 +1,9 @@
 #include <sys/epoll.h>
+#include <sys/syscall.h>
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
+#include <time.h>
 
 #include <iostream>
 
@@ -11,7 +14,7 @@ using namespace std;
 
 namespace cppbase {
 
-bool EventPoll::flags_sanity_check(uint32_t flags)
+bool EventPoll::flags_sanity_check(uint32_t flags, bool add)
 {	
 	if (-1 == epoll_fd_) {
 		cerr << "epoll is not init successfully" << endl;
@@ -23,11 +26,22 @@ bool EventPoll::flags_sanity_check(uint32_t flags)
 		return false;
 	}
 
-	if (flags & (~EPOLL_ALL_FLAGS)) {
+	if (flags & (~(EPOLL_ALL_FLAGS|EPOLL_ALL_MODIFIERS))) {
 		cerr << "There are non-permit flags" << endl;
 		return false;
 	}
 
+	if (flags & EPOLL_EPOLLEXCLUSIVE) {
+		if (!add) {
+			cerr << "EPOLLEXCLUSIVE is only permitted when adding fd" << endl;
+			return false;
+		}
+		if (flags & (EPOLL_EPOLLONESHOT|EPOLL_EPOLLRDHUP)) {
+			cerr << "EPOLLEXCLUSIVE could not be used with EPOLLONESHOT or EPOLLRDHUP" << endl;
+			return false;
+		}
+	}
+
 	return true;
 }
 
@@ -43,9 +57,33 @@ void EventPoll::convert_epoll_flags(struct epoll_event & event, int fd, uint32_t
 	if (flags & EPOLL_EPOLLRDHUP) {
 		event.events |= EPOLLRDHUP;
 	}
+	if (flags & EPOLL_EPOLLET) {
+		event.events |= EPOLLET;
+	}
+	if (flags & EPOLL_EPOLLONESHOT) {
+		event.events |= EPOLLONESHOT;
+	}
+	if (flags & EPOLL_EPOLLEXCLUSIVE) {
+		event.events |= EPOLLEXCLUSIVE;
+	}
 	event.data.fd = fd;
 }
 
+bool EventPoll::epoll_ctl_event(int op, int fd, struct epoll_event &event)
+{
+	int ret = epoll_ctl(epoll_fd_, op, fd, &event);
+	if (0 != ret) {
+		cerr << "epoll_ctl failed: " << strerror(errno) << endl;
+		return false;
+	}
+
+	if (op == EPOLL_CTL_ADD) {
+		mon_fd_cnts_++;
+		ready_events_.push_back(event);
+	}
+
+	return true;
+}
 
 bool EventPoll::init(void)
 {
@@ -60,43 +98,74 @@ bool EventPoll::init(void)
 
 bool EventPoll::epoll_add_fd(int fd, unsigned int flags)
 {
-	if (!flags_sanity_check(flags)) {
+	if (mode_ != EPOLL_FD_MODE) {
+		cerr << "epoll is not in fd mode" << endl;
+		return false;
+	}
+
+	if (!flags_sanity_check(flags, true)) {
 		return false;
 	}
 	
 	struct epoll_event event;
 	convert_epoll_flags(event, fd, flags);
 
-	int ret = epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
-	if (0 != ret) {
-		cerr << "epoll_ctl failed: " << strerror(errno) << endl;
+	// LOG_DEBUG << "Add fd " << fd << " into epoll successfully" << endl;
+	return epoll_ctl_event(EPOLL_CTL_ADD, fd, event);
+}
+
+bool EventPoll::epoll_modify_fd(int fd, unsigned int flags)
+{
+	if (mode_ != EPOLL_FD_MODE) {
+		cerr << "epoll is not in fd mode" << endl;
 		return false;
 	}
-	// LOG_DEBUG << "Add fd " << fd << " into epoll successfully" << endl;
 
-	mon_fd_cnts_++;
-	ready_events_.push_back(event);
+	if (!flags_sanity_check(flags, false)) {
+		return false;
+	}
+	
+	struct epoll_event event;
+	convert_epoll_flags(event, fd, flags);
 
-	return true;
+	// LOG_DEBUG << "Modify fd " << fd << " into epoll successfully" << endl;
+	return epoll_ctl_event(EPOLL_CTL_MOD, fd, event);
 }
 
-bool EventPoll::epoll_modify_fd(int fd,unsigned int flags)
+bool EventPoll::epoll_add_handler(int fd, EventHandler *handler, uint32_t flags)
 {
-	if (!flags_sanity_check(flags)) {
+	if (mode_ != EPOLL_HANDLER_MODE) {
+		cerr << "epoll is not in handler mode" << endl;
 		return false;
 	}
-	
+
+	if (!flags_sanity_check(flags, true)) {
+		return false;
+	}
+
 	struct epoll_event event;
 	convert_epoll_flags(event, fd, flags);
+	event.data.ptr = handler;
 
-	int ret = epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event);
-	if (0 != ret) {
-		cerr << "epoll_ctl failed: " << strerror(errno) << endl;
+	return epoll_ctl_event(EPOLL_CTL_ADD, fd, event);
+}
+
+bool EventPoll::epoll_modify_handler(int fd, EventHandler *handler, uint32_t flags)
+{
+	if (mode_ != EPOLL_HANDLER_MODE) {
+		cerr << "epoll is not in handler mode" << endl;
 		return false;
 	}
-	// LOG_DEBUG << "Modify fd " << fd << " into epoll successfully" << endl;
 
-	return true;	
+	if (!flags_sanity_check(flags, false)) {
+		return false;
+	}
+
+	struct epoll_event event;
+	convert_epoll_flags(event, fd, flags);
+	event.data.ptr = handler;
+
+	return epoll_ctl_event(EPOLL_CTL_MOD, fd, event);
 }
 
 void EventPoll::epoll_del_fd(int fd)
@@ -110,38 +179,101 @@ void EventPoll::epoll_del_fd(int fd)
 	}
 }
 
-uint32_t EventPoll::epoll_wait(std::vector<EPEvent> &ready_fds, int wait_secs)
+#ifdef __NR_epoll_pwait2
+/* Cleared when the kernel doesn't support epoll_pwait2 */
+static bool epoll_pwait2_supported = true;
+#endif
+
+int EventPoll::wait_ready_events(int64_t wait_nsecs)
 {
-	if (-1 != wait_secs) {
-		wait_secs *= 1000;
+	int ret = -1;
+	bool waited = false;
+
+#ifdef __NR_epoll_pwait2
+	if (epoll_pwait2_supported) {
+		struct timespec timeout;
+		struct timespec *ptimeout = NULL;
+
+		if (wait_nsecs >= 0) {
+			timeout.tv_sec = wait_nsecs / 1000000000LL;
+			timeout.tv_nsec = wait_nsecs % 1000000000LL;
+			ptimeout = &timeout;
+		}
+
+		ret = syscall(__NR_epoll_pwait2, epoll_fd_, &ready_events_[0], ready_events_.size(), ptimeout, NULL, 0);
+		if (-1 == ret && errno == ENOSYS) {
+			epoll_pwait2_supported = false;
+		} else {
+			waited = true;
+		}
+	}
+#endif
+
+	if (!waited) {
+		int wait_msecs = -1;
+
+		if (wait_nsecs >= 0) {
+			// Round up, don't wake up before the deadline
+			int64_t msecs = (wait_nsecs + 999999) / 1000000;
+			wait_msecs = (msecs > INT_MAX) ? INT_MAX : msecs;
+		}
+		ret = ::epoll_wait(epoll_fd_, &ready_events_[0], ready_events_.size(), wait_msecs);
 	}
 
-	int ret = ::epoll_wait(epoll_fd_, &ready_events_[0], ready_events_.size(), wait_secs);
 	if (-1 == ret) {
 		// LOG_DEBUG << "epoll_wait failed " << strerror(errno) << endl;
 		if (errno != EINTR) {
 			// LOG_ERROR << "epoll_wait failed " << strerror(errno) << endl;
 			cerr << "epoll_wait failed: " << strerror(errno) << endl;
 		}
-		ready_fds.resize(0);
-		return 0;
-	} else if (0 == ret) {
-		ready_fds.resize(0);
 		return 0;
 	}
 
-	if ((uint32_t)ret > ready_fds.capacity()) {
-		ready_fds.reserve(ret);
+	// LOG_DEBUG << "epoll_wait finds " << ret << " ready fds" << endl;
+	return ret;
+}
+
+uint32_t EventPoll::epoll_wait(std::vector<EPEvent> &ready_fds, int wait_secs)
+{
+	return epoll_wait_ns(ready_fds, (-1 == wait_secs) ? -1 : wait_secs * 1000000000LL);
+}
+
+uint32_t EventPoll::epoll_wait_ns(std::vector<EPEvent> &ready_fds, int64_t wait_nsecs)
+{
+	int ret = wait_ready_events(wait_nsecs);
+
+	ready_fds.resize(ret);
+	for (int i = 0; i < ret; ++i) {
+		if (mode_ == EPOLL_HANDLER_MODE) {
+			ready_fds[i] = EPEvent(static_cast<EventHandler*>(ready_events_[i].data.ptr), ready_events_[i].events);
+		} else {
+			ready_fds[i] = EPEvent(ready_events_[i].data.fd, ready_events_[i].events);
+		}
+	}
+
+	return ret;
+}
+
+uint32_t EventPoll::epoll_dispatch(int wait_msecs)
+{
+	return epoll_dispatch_ns((-1 == wait_msecs) ? -1 : wait_msecs * 1000000LL);
+}
+
+uint32_t EventPoll::epoll_dispatch_ns(int64_t wait_nsecs)
+{
+	if (mode_ != EPOLL_HANDLER_MODE) {
+		cerr << "epoll is not in handler mode" << endl;
+		return 0;
 	}
 
+	int ret = wait_ready_events(wait_nsecs);
+
 	for (int i = 0; i < ret; ++i) {
-		EPEvent e(ready_events_[i].data.fd, ready_events_[i].events);
+		EventHandler *handler = static_cast<EventHandler*>(ready_events_[i].data.ptr);
 
-		ready_fds[i] = e;
+		handler->handle_events(ready_events_[i].events);
 	}
-	ready_fds.resize(ret);
 
-	// LOG_DEBUG << "epoll_wait finds " << ret << " ready fds" << endl;
 	return ret;
 }
 
@@ -0,0 +1,227 @@
+#include "core/event/timer_wheel.hpp"
+#include "base/utils/compiler.hpp"
+
+#include <utility>
+
+using namespace std;
+
+namespace cppbase {
+
+const uint64_t TimerWheel::DEFAULT_TICK_NSECS;
+
+TimerWheel::TimerWheel(uint64_t tick_nsecs)
+	: tick_nsecs_(tick_nsecs ? tick_nsecs : 1), cur_tick_(0), started_(false), pending_cnt_(0)
+{
+	for (uint32_t i = 0; i < TIMER_WHEEL_LEVELS; ++i) {
+		slot_bitmap_[i] = 0;
+	}
+}
+
+bool TimerWheel::set_tick_nsecs(uint64_t tick_nsecs)
+{
+	if (pending_cnt_) {
+		return false;
+	}
+
+	tick_nsecs_ = tick_nsecs ? tick_nsecs : 1;
+	started_ = false;
+	return true;
+}
+
+TimerWheel::TimerId TimerWheel::add_timer(const TimerCallback &cb, uint64_t delay_nsecs, void *data, uint64_t now_nsecs)
+{
+	if (!started_) {
+		cur_tick_ = now_nsecs / tick_nsecs_;
+		started_ = true;
+	}
+
+	TimerNode *node;
+	if (free_nodes_.empty()) {
+		nodes_.emplace_back();
+		node = &nodes_.back();
+		node->index_ = nodes_.size() - 1;
+	} else {
+		node = &nodes_[free_nodes_.back()];
+		free_nodes_.pop_back();
+	}
+
+	// Round up, the timer never expires early
+	node->expire_tick_ = (now_nsecs + delay_nsecs + tick_nsecs_ - 1) / tick_nsecs_;
+	if (node->expire_tick_ < cur_tick_) {
+		node->expire_tick_ = cur_tick_;
+	}
+	node->cb_ = cb;
+	node->data_ = data;
+
+	enqueue(node);
+	++pending_cnt_;
+
+	return (static_cast<uint64_t>(node->gen_) << 32) | (node->index_ + 1);
+}
+
+bool TimerWheel::cancel_timer(TimerId id)
+{
+	uint32_t index = static_cast<uint32_t>(id);
+
+	if (!index || index > nodes_.size()) {
+		return false;
+	}
+
+	TimerNode *node = &nodes_[index - 1];
+	if (node->gen_ != static_cast<uint32_t>(id >> 32) || !node->link_.linked()) {
+		return false;
+	}
+
+	dequeue(node);
+	free_node(node);
+	--pending_cnt_;
+
+	return true;
+}
+
+uint32_t TimerWheel::run_timers(uint64_t now_nsecs)
+{
+	uint64_t target = now_nsecs / tick_nsecs_;
+	uint32_t cnt = 0;
+
+	if (!pending_cnt_) {
+		cur_tick_ = target + 1;
+		started_ = true;
+		return 0;
+	}
+
+	while (cur_tick_ <= target && pending_cnt_) {
+		uint32_t index = cur_tick_ & TIMER_WHEEL_SLOT_MASK;
+
+		if (!index) {
+			for (uint32_t level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+				cascade(level);
+				if ((cur_tick_ >> (level * TIMER_WHEEL_LEVEL_BITS)) & TIMER_WHEEL_SLOT_MASK) {
+					break;
+				}
+			}
+		} else if (!slot_bitmap_[0]) {
+			// Skip the empty ticks till the next cascade
+			uint64_t next = (cur_tick_ | TIMER_WHEEL_SLOT_MASK) + 1;
+			cur_tick_ = (next <= target) ? next : target + 1;
+			continue;
+		}
+
+		TimerList expired;
+		wheel_[0][index].splice_tail(&expired);
+		slot_bitmap_[0] &= ~(1ULL << index);
+		++cur_tick_;
+
+		// The callback may add or cancel timers, pick the first one every time
+		while (!expired.empty()) {
+			TimerNode *node = expired.first_owner();
+			TimerCallback cb;
+			void *data = node->data_;
+
+			cb.swap(node->cb_);
+			node->link_.del();
+			free_node(node);
+			--pending_cnt_;
+
+			cb(data);
+			++cnt;
+		}
+	}
+
+	if (cur_tick_ <= target) {
+		cur_tick_ = target + 1;
+	}
+
+	return cnt;
+}
+
+int64_t TimerWheel::next_timeout_nsecs(uint64_t now_nsecs) const
+{
+	if (!pending_cnt_) {
+		return -1;
+	}
+
+	uint32_t index = cur_tick_ & TIMER_WHEEL_SLOT_MASK;
+	// The higher levels are moved down at the next round of level 0
+	uint64_t next_tick = (cur_tick_ + TIMER_WHEEL_SLOT_MASK) & ~static_cast<uint64_t>(TIMER_WHEEL_SLOT_MASK);
+
+	if (slot_bitmap_[0]) {
+		uint64_t bits = slot_bitmap_[0];
+		uint64_t rotated = index ? ((bits >> index) | (bits << (TIMER_WHEEL_SLOTS - index))) : bits;
+		uint64_t tick = cur_tick_ + __builtin_ctzll(rotated);
+
+		bool higher = false;
+		for (uint32_t level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+			if (slot_bitmap_[level]) {
+				higher = true;
+				break;
+			}
+		}
+		if (!higher || tick < next_tick) {
+			next_tick = tick;
+		}
+	}
+
+	uint64_t deadline = next_tick * tick_nsecs_;
+	return (deadline > now_nsecs) ? static_cast<int64_t>(deadline - now_nsecs) : 0;
+}
+
+void TimerWheel::enqueue(TimerNode *node)
+{
+	uint64_t expire = node->expire_tick_;
+	uint64_t delta = expire - cur_tick_;
+	uint32_t level = 0;
+
+	if (delta > TIMER_WHEEL_MAX_TICKS) {
+		delta = TIMER_WHEEL_MAX_TICKS;
+		expire = cur_tick_ + delta;
+	}
+
+	while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << ((level + 1) * TIMER_WHEEL_LEVEL_BITS))) {
+		++level;
+	}
+
+	uint32_t slot = (expire >> (level * TIMER_WHEEL_LEVEL_BITS)) & TIMER_WHEEL_SLOT_MASK;
+
+	node->level_ = level;
+	node->slot_ = slot;
+	node->link_.add_tail(&wheel_[level][slot]);
+	slot_bitmap_[level] |= 1ULL << slot;
+}
+
+void TimerWheel::dequeue(TimerNode *node)
+{
+	node->link_.del();
+	if (wheel_[node->level_][node->slot_].empty()) {
+		slot_bitmap_[node->level_] &= ~(1ULL << node->slot_);
+	}
+}
+
+void TimerWheel::cascade(uint32_t level)
+{
+	uint32_t slot = (cur_tick_ >> (level * TIMER_WHEEL_LEVEL_BITS)) & TIMER_WHEEL_SLOT_MASK;
+	TimerList moving;
+
+	wheel_[level][slot].splice_tail(&moving);
+	slot_bitmap_[level] &= ~(1ULL << slot);
+
+	while (!moving.empty()) {
+		TimerNode *node = moving.first_owner();
+
+		node->link_.del();
+		enqueue(node);
+	}
+}
+
+void TimerWheel::free_node(TimerNode *node)
+{
+	BUG_ON(node->link_.linked());
+
+	// The old ids become invalid
+	++node->gen_;
+	node->cb_ = nullptr;
+	node->data_ = NULL;
+	free_nodes_.push_back(node->index_);
+}
+
+}
@@ -0,0 +1,487 @@
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iostream>
+
+#ifdef CPPBASE_HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#include "core/event/uring_poll.hpp"
+
+using namespace std;
+
+namespace cppbase {
+
+#ifdef CPPBASE_HAVE_IO_URING
+
+/* Multishot recv with the provided buffer ring exists since 6.0 */
+#define URING_MIN_KERNEL_MAJOR	6
+#define URING_MIN_KERNEL_MINOR	0
+
+#define URING_BUF_GROUP_ID		0
+
+/*
+The flex array bufs of io_uring_buf_ring is shifted by the empty struct in C++,
+so index the ring entries by ourselves.
+*/
+static inline struct io_uring_buf *buf_ring_entry(struct io_uring_buf_ring *ring, uint32_t idx)
+{
+	return reinterpret_cast<struct io_uring_buf*>(ring) + idx;
+}
+
+static inline uint32_t load_acquire(const uint32_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(uint32_t *p, uint32_t v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+bool UringPoll::Completion::more(void) const
+{
+	return (flags_ & IORING_CQE_F_MORE);
+}
+
+bool UringPoll::Completion::has_buffer(void) const
+{
+	return (flags_ & IORING_CQE_F_BUFFER);
+}
+
+uint16_t UringPoll::Completion::buffer_id(void) const
+{
+	return (flags_ >> IORING_CQE_BUFFER_SHIFT);
+}
+
+UringPoll::UringPoll()
+	: ring_fd_(-1), sq_ptr_(MAP_FAILED), sq_len_(0), sq_head_(NULL), sq_tail_(NULL), sq_mask_(0),
+	sq_array_(NULL), sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)), sqes_len_(0), sqe_tail_(0),
+	to_submit_(0), cq_ptr_(MAP_FAILED), cq_len_(0), cq_head_(NULL), cq_tail_(NULL), cq_mask_(0),
+	cqes_(NULL), buf_ring_(static_cast<struct io_uring_buf_ring*>(MAP_FAILED)), buf_ring_len_(0),
+	buf_cnt_(0), buf_size_(0), bufs_(NULL), buf_tail_(0)
+{
+}
+
+UringPoll::~UringPoll()
+{
+	release();
+}
+
+void UringPoll::release(void)
+{
+	if (buf_ring_ != MAP_FAILED) {
+		munmap(buf_ring_, buf_ring_len_);
+		buf_ring_ = static_cast<struct io_uring_buf_ring*>(MAP_FAILED);
+	}
+	if (bufs_) {
+		munmap(bufs_, static_cast<size_t>(buf_cnt_) * buf_size_);
+		bufs_ = NULL;
+	}
+	if (sqes_ != MAP_FAILED) {
+		munmap(sqes_, sqes_len_);
+		sqes_ = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+	}
+	if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+		munmap(cq_ptr_, cq_len_);
+	}
+	cq_ptr_ = MAP_FAILED;
+	if (sq_ptr_ != MAP_FAILED) {
+		munmap(sq_ptr_, sq_len_);
+		sq_ptr_ = MAP_FAILED;
+	}
+	if (ring_fd_ != -1) {
+		close(ring_fd_);
+		ring_fd_ = -1;
+	}
+}
+
+bool UringPoll::supported(void)
+{
+	struct utsname name;
+	int major = 0;
+	int minor = 0;
+
+	if (uname(&name) || sscanf(name.release, "%d.%d", &major, &minor) != 2) {
+		return false;
+	}
+
+	if (major != URING_MIN_KERNEL_MAJOR) {
+		return (major > URING_MIN_KERNEL_MAJOR);
+	}
+	return (minor >= URING_MIN_KERNEL_MINOR);
+}
+
+bool UringPoll::init(uint32_t entries, uint32_t buf_cnt, uint32_t buf_size)
+{
+	if (!supported()) {
+		cerr << "The kernel is too old to run io_uring reactor" << endl;
+		return false;
+	}
+
+	if (!buf_cnt || (buf_cnt & (buf_cnt-1)) || buf_cnt > 32768) {
+		cerr << "The io_uring buffer count must be power of 2" << endl;
+		return false;
+	}
+
+	if (!setup_rings(entries) || !setup_buf_ring(buf_cnt, buf_size)) {
+		release();
+		return false;
+	}
+
+	return true;
+}
+
+bool UringPoll::setup_rings(uint32_t entries)
+{
+	struct io_uring_params params;
+
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CLAMP;
+
+	ring_fd_ = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring_fd_ == -1) {
+		cerr << "Fail to io_uring_setup: " << strerror(errno) << endl;
+		return false;
+	}
+
+	const uint32_t required_feats = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+	if ((params.features & required_feats) != required_feats) {
+		cerr << "io_uring lacks the required features" << endl;
+		return false;
+	}
+
+	sq_len_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	cq_len_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (cq_len_ > sq_len_) {
+		sq_len_ = cq_len_;
+	}
+
+	sq_ptr_ = mmap(NULL, sq_len_, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+	if (sq_ptr_ == MAP_FAILED) {
+		cerr << "Fail to mmap io_uring: " << strerror(errno) << endl;
+		return false;
+	}
+	// IORING_FEAT_SINGLE_MMAP: the cq ring shares the mapping with the sq ring
+	cq_ptr_ = sq_ptr_;
+	cq_len_ = sq_len_;
+
+	sqes_len_ = params.sq_entries * sizeof(struct io_uring_sqe);
+	sqes_ = static_cast<struct io_uring_sqe*>(mmap(NULL, sqes_len_, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+	if (sqes_ == MAP_FAILED) {
+		cerr << "Fail to mmap io_uring sqes: " << strerror(errno) << endl;
+		return false;
+	}
+
+	uint8_t *sq = static_cast<uint8_t*>(sq_ptr_);
+	sq_head_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+	sq_tail_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+	sq_mask_ = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+	sq_array_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+	sqe_tail_ = *sq_tail_;
+
+	uint8_t *cq = static_cast<uint8_t*>(cq_ptr_);
+	cq_head_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+	cq_tail_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+	cq_mask_ = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+	cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+	return true;
+}
+
+bool UringPoll::setup_buf_ring(uint32_t buf_cnt, uint32_t buf_size)
+{
+	buf_cnt_ = buf_cnt;
+	buf_size_ = buf_size;
+
+	buf_ring_len_ = buf_cnt * sizeof(struct io_uring_buf);
+	buf_ring_ = static_cast<struct io_uring_buf_ring*>(mmap(NULL, buf_ring_len_, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0));
+	if (buf_ring_ == MAP_FAILED) {
+		cerr << "Fail to mmap io_uring buffer ring: " << strerror(errno) << endl;
+		return false;
+	}
+
+	void *bufs = mmap(NULL, static_cast<size_t>(buf_cnt) * buf_size, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (bufs == MAP_FAILED) {
+		cerr << "Fail to mmap io_uring buffers: " << strerror(errno) << endl;
+		return false;
+	}
+	bufs_ = static_cast<uint8_t*>(bufs);
+
+	buf_tail_ = 0;
+	for (uint32_t i = 0; i < buf_cnt; ++i) {
+		struct io_uring_buf *buf = buf_ring_entry(buf_ring_, i);
+
+		buf->addr = reinterpret_cast<uint64_t>(get_buffer(i));
+		buf->len = buf_size_;
+		buf->bid = i;
+	}
+	buf_tail_ = buf_cnt;
+	__atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+	reg.ring_entries = buf_cnt;
+	reg.bgid = URING_BUF_GROUP_ID;
+
+	if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+		cerr << "Fail to register io_uring buffer ring: " << strerror(errno) << endl;
+		return false;
+	}
+
+	return true;
+}
+
+void UringPoll::recycle_buffer(uint16_t bid)
+{
+	struct io_uring_buf *buf = buf_ring_entry(buf_ring_, buf_tail_ & (buf_cnt_-1));
+
+	buf->addr = reinterpret_cast<uint64_t>(get_buffer(bid));
+	buf->len = buf_size_;
+	buf->bid = bid;
+	buf_tail_++;
+	__atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+}
+
+int UringPoll::enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags, arg, argsz);
+}
+
+struct io_uring_sqe *UringPoll::get_sqe(void)
+{
+	if (ring_fd_ == -1) {
+		return NULL;
+	}
+
+	if (sqe_tail_ - load_acquire(sq_head_) > sq_mask_) {
+		// The sq is full, submit them without waiting
+		store_release(sq_tail_, sqe_tail_);
+		if (enter(to_submit_, 0, 0, NULL, 0) < 0) {
+			cerr << "Fail to submit io_uring sqes: " << strerror(errno) << endl;
+			return NULL;
+		}
+		to_submit_ = 0;
+		if (sqe_tail_ - load_acquire(sq_head_) > sq_mask_) {
+			return NULL;
+		}
+	}
+
+	uint32_t idx = sqe_tail_ & sq_mask_;
+	struct io_uring_sqe *sqe = &sqes_[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sq_array_[idx] = idx;
+	sqe_tail_++;
+	to_submit_++;
+
+	return sqe;
+}
+
+bool UringPoll::prep_accept_multishot(int fd, uint32_t flags, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = get_sqe();
+	if (!sqe) {
+		return false;
+	}
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = flags;
+	sqe->user_data = user_data;
+
+	return true;
+}
+
+bool UringPoll::prep_recv_multishot(int fd, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = get_sqe();
+	if (!sqe) {
+		return false;
+	}
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUF_GROUP_ID;
+	sqe->user_data = user_data;
+
+	return true;
+}
+
+bool UringPoll::prep_sendmsg(int fd, const struct msghdr *msg, uint32_t flags, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = get_sqe();
+	if (!sqe) {
+		return false;
+	}
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = fd;
+	sqe->addr = reinterpret_cast<uint64_t>(msg);
+	sqe->len = 1;
+	sqe->msg_flags = flags;
+	sqe->user_data = user_data;
+
+	return true;
+}
+
+bool UringPoll::prep_poll_multishot(int fd, uint32_t events, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = get_sqe();
+	if (!sqe) {
+		return false;
+	}
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->poll32_events = events;
+	sqe->user_data = user_data;
+
+	return true;
+}
+
+bool UringPoll::prep_cancel(uint64_t target_user_data, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = get_sqe();
+	if (!sqe) {
+		return false;
+	}
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = target_user_data;
+	sqe->user_data = user_data;
+
+	return true;
+}
+
+uint32_t UringPoll::submit_and_wait(std::vector<Completion> &cqes, int64_t wait_nsecs)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	uint32_t flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+
+	memset(&arg, 0, sizeof(arg));
+	if (wait_nsecs >= 0) {
+		ts.tv_sec = wait_nsecs / 1000000000LL;
+		ts.tv_nsec = wait_nsecs % 1000000000LL;
+		arg.ts = reinterpret_cast<uint64_t>(&ts);
+	}
+
+	cqes.resize(0);
+	store_release(sq_tail_, sqe_tail_);
+
+	// Don't wait when there are completions already
+	uint32_t min_complete = (load_acquire(cq_tail_) == *cq_head_) ? 1 : 0;
+	int ret = enter(to_submit_, min_complete, flags, &arg, sizeof(arg));
+	if (ret >= 0) {
+		to_submit_ -= (static_cast<uint32_t>(ret) > to_submit_) ? to_submit_ : ret;
+	} else if (errno != ETIME && errno != EINTR && errno != EBUSY) {
+		cerr << "io_uring_enter failed: " << strerror(errno) << endl;
+	} else if (errno == ETIME) {
+		// The sqes are consumed before waiting
+		to_submit_ = 0;
+	}
+
+	uint32_t head = *cq_head_;
+	uint32_t tail = load_acquire(cq_tail_);
+	for (; head != tail; ++head) {
+		struct io_uring_cqe *cqe = &cqes_[head & cq_mask_];
+
+		cqes.push_back(Completion(cqe->user_data, cqe->res, cqe->flags));
+	}
+	store_release(cq_head_, head);
+
+	return cqes.size();
+}
+
+#else /* CPPBASE_HAVE_IO_URING */
+
+bool UringPoll::Completion::more(void) const
+{
+	return false;
+}
+
+bool UringPoll::Completion::has_buffer(void) const
+{
+	return false;
+}
+
+uint16_t UringPoll::Completion::buffer_id(void) const
+{
+	return 0;
+}
+
+UringPoll::UringPoll(): ring_fd_(-1), bufs_(NULL)
+{
+}
+
+UringPoll::~UringPoll()
+{
+}
+
+bool UringPoll::supported(void)
+{
+	return false;
+}
+
+bool UringPoll::init(uint32_t entries, uint32_t buf_cnt, uint32_t buf_size)
+{
+	cerr << "cppbase is built without io_uring" << endl;
+	return false;
+}
+
+bool UringPoll::prep_accept_multishot(int fd, uint32_t flags, uint64_t user_data)
+{
+	return false;
+}
+
+bool UringPoll::prep_recv_multishot(int fd, uint64_t user_data)
+{
+	return false;
+}
+
+bool UringPoll::prep_sendmsg(int fd, const struct msghdr *msg, uint32_t flags, uint64_t user_data)
+{
+	return false;
+}
+
+bool UringPoll::prep_poll_multishot(int fd, uint32_t events, uint64_t user_data)
+{
+	return false;
+}
+
+bool UringPoll::prep_cancel(uint64_t target_user_data, uint64_t user_data)
+{
+	return false;
+}
+
+uint32_t UringPoll::submit_and_wait(std::vector<Completion> &cqes, int64_t wait_nsecs)
+{
+	cqes.resize(0);
+	return 0;
+}
+
+void UringPoll::recycle_buffer(uint16_t bid)
+{
+}
+
+#endif /* CPPBASE_HAVE_IO_URING */
+
+}
@@ -0,0 +1,209 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <new>
+
+#include "base/utils/ik_logger.h"
+#include "core/net/buffer_pool.hpp"
+#include "core/thread/pthread_lock.hpp"
+
+namespace cppbase {
+
+std::atomic<bool> BufferPool::hugepage_slabs_(false);
+std::atomic<size_t> BufferPool::slab_bytes_(0);
+
+/*
+The slab chunks spilled by the threads which free more than they get, i.e. the workers
+consuming the offloaded messages. The count is checked before locking.
+*/
+struct SharedChunks {
+	SharedChunks(): cnt_(0) {
+	}
+	Mutex lock_;
+	std::vector<BufferPool::Chunk> chunks_;
+	std::atomic<size_t> cnt_;
+};
+static SharedChunks shared_chunks[BufferPool::BUF_CLASS_CNT];
+
+/* The chunks released after the thread exits are not cached */
+static thread_local bool tls_pool_exited = false;
+
+class BufferPoolHolder {
+public:
+	~BufferPoolHolder() {
+		tls_pool_exited = true;
+	}
+	BufferPool pool_;
+};
+
+BufferPool::BufferPool()
+{
+	for (uint32_t i = 0; i < BUF_CLASS_CNT; ++i) {
+		cached_bytes_[i] = 0;
+	}
+}
+
+BufferPool::~BufferPool()
+{
+	for (uint32_t i = 0; i < BUF_CLASS_CNT; ++i) {
+		for (auto it = free_chunks_[i].begin(); it != free_chunks_[i].end(); ++it) {
+			// The slab may be used by other threads, it is never unmapped
+			if (it->slab_) {
+				spill_shared(*it);
+			} else {
+				::free(it->data_);
+			}
+		}
+	}
+}
+
+BufferPool *BufferPool::local(void)
+{
+	if (tls_pool_exited) {
+		return NULL;
+	}
+
+	static thread_local BufferPoolHolder holder;
+	return &holder.pool_;
+}
+
+BufferPool::SizeClass BufferPool::size_class(uint32_t size)
+{
+	uint32_t cls = BUF_CLASS_1K;
+
+	while (cls < BUF_CLASS_64K && class_bytes(static_cast<SizeClass>(cls)) < size) {
+		++cls;
+	}
+	return static_cast<SizeClass>(cls);
+}
+
+BufferPool::Chunk BufferPool::get(SizeClass cls)
+{
+	BufferPool *pool = local();
+	Chunk chunk;
+
+	if (pool) {
+		std::vector<Chunk> &chunks = pool->free_chunks_[cls];
+
+		if (chunks.empty() && !pool->refill_shared(cls) && hugepage_slabs_.load(std::memory_order_relaxed)) {
+			pool->carve_slab(cls);
+		}
+		if (!chunks.empty()) {
+			chunk = chunks.back();
+			chunks.pop_back();
+			pool->cached_bytes_[cls] -= class_bytes(cls);
+			return chunk;
+		}
+	}
+
+	chunk.data_ = static_cast<uint8_t*>(malloc(class_bytes(cls)));
+	if (!chunk.data_) {
+		throw std::bad_alloc();
+	}
+	chunk.cls_ = cls;
+	return chunk;
+}
+
+void BufferPool::put(const Chunk &chunk)
+{
+	BufferPool *pool = local();
+
+	if (pool && pool->cached_bytes_[chunk.cls_] < BUF_POOL_CACHE_BYTES) {
+		pool->free_chunks_[chunk.cls_].push_back(chunk);
+		pool->cached_bytes_[chunk.cls_] += class_bytes(chunk.cls_);
+	} else if (chunk.slab_) {
+		spill_shared(chunk);
+	} else {
+		::free(chunk.data_);
+	}
+}
+
+bool BufferPool::refill_shared(SizeClass cls)
+{
+	SharedChunks &shared = shared_chunks[cls];
+
+	if (shared.cnt_.load(std::memory_order_relaxed) == 0) {
+		return false;
+	}
+
+	// Take half of the cache at most, so the put of this thread doesn't spill them back at once
+	uint32_t bytes = class_bytes(cls);
+	size_t cnt = BUF_POOL_CACHE_BYTES / 2 / bytes;
+	LockGuard<Mutex> guard(shared.lock_);
+
+	cnt = std::min(cnt, shared.chunks_.size());
+	free_chunks_[cls].insert(free_chunks_[cls].end(), shared.chunks_.end() - cnt, shared.chunks_.end());
+	shared.chunks_.resize(shared.chunks_.size() - cnt);
+	shared.cnt_.store(shared.chunks_.size(), std::memory_order_relaxed);
+	cached_bytes_[cls] += cnt * bytes;
+	return cnt != 0;
+}
+
+void BufferPool::spill_shared(const Chunk &chunk)
+{
+	SharedChunks &shared = shared_chunks[chunk.cls_];
+	LockGuard<Mutex> guard(shared.lock_);
+
+	shared.chunks_.push_back(chunk);
+	shared.cnt_.store(shared.chunks_.size(), std::memory_order_relaxed);
+}
+
+size_t BufferPool::cached_bytes(void)
+{
+	BufferPool *pool = local();
+	size_t bytes = 0;
+
+	if (pool) {
+		for (uint32_t i = 0; i < BUF_CLASS_CNT; ++i) {
+			bytes += pool->cached_bytes_[i];
+		}
+	}
+	return bytes;
+}
+
+bool BufferPool::carve_slab(SizeClass cls)
+{
+	void *mem = mmap(NULL, BUF_POOL_SLAB_BYTES, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+
+	if (mem == MAP_FAILED) {
+		// No reserved huge pages, map twice the size to align it for the transparent huge page
+		uint8_t *raw = static_cast<uint8_t*>(mmap(NULL, BUF_POOL_SLAB_BYTES * 2, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS, -1, 0));
+		if (raw == MAP_FAILED) {
+			LOG_WARN("Fail to map the buffer slab: %s", strerror(errno));
+			return false;
+		}
+
+		uintptr_t addr = reinterpret_cast<uintptr_t>(raw);
+		uint8_t *aligned = reinterpret_cast<uint8_t*>((addr + BUF_POOL_SLAB_BYTES - 1) & ~static_cast<uintptr_t>(BUF_POOL_SLAB_BYTES - 1));
+		size_t head = aligned - raw;
+
+		if (head) {
+			munmap(raw, head);
+		}
+		munmap(aligned + BUF_POOL_SLAB_BYTES, BUF_POOL_SLAB_BYTES - head);
+		madvise(aligned, BUF_POOL_SLAB_BYTES, MADV_HUGEPAGE);
+		mem = aligned;
+	}
+
+	uint32_t bytes = class_bytes(cls);
+	uint8_t *start = static_cast<uint8_t*>(mem);
+
+	for (uint32_t offset = 0; offset + bytes <= BUF_POOL_SLAB_BYTES; offset += bytes) {
+		Chunk chunk;
+
+		chunk.data_ = start + offset;
+		chunk.cls_ = cls;
+		chunk.slab_ = true;
+		free_chunks_[cls].push_back(chunk);
+		cached_bytes_[cls] += bytes;
+	}
+	slab_bytes_.fetch_add(BUF_POOL_SLAB_BYTES, std::memory_order_relaxed);
+	return true;
+}
+
+}
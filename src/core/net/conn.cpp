@@ -1,38 +1,77 @@
 #include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <linux/sockios.h>
+#include <linux/errqueue.h>
 #include <memory>
 #include "base/utils/compiler.hpp"
 #include "base/utils/ik_logger.h"
+#include "base/utils/noncopyable.hpp"
+#include "core/net/buffer_pool.hpp"
 #include "core/net/conn.hpp"
 
 using namespace std;
 
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
 namespace cppbase {
 
-class Buffer {
+class Buffer: noncopyable {
 public:
 	enum {
 		MSG_BUF_MIN_SIZE = 0,
-		MSG_BUF_DEFAULT_SIZE = 1024,
 	}; 
 
-	Buffer(): data_(MSG_BUF_DEFAULT_SIZE), head_(0), tail_(0) {
+	/* The memory is got from the buffer pool by the size class fitting size_hint */
+	explicit Buffer(uint32_t size_hint): chunk_(BufferPool::get(BufferPool::size_class(size_hint))),
+		base_(chunk_.data_), capacity_(BufferPool::class_bytes(chunk_.cls_)), head_(0), tail_(0),
+		file_fd_(-1), file_offset_(0) {
+	}
+	/* Refer to the bytes of the slice, it is full and never written */
+	explicit Buffer(const SharedSlice &slice): base_(const_cast<uint8_t*>(slice.data())),
+		capacity_(slice.size()), head_(0), tail_(slice.size()), holder_(slice.holder()),
+		file_fd_(-1), file_offset_(0) {
+	}
+	/* Refer to the file range, it has no memory */
+	explicit Buffer(const FileSlice &file): base_(NULL), capacity_(file.size()), head_(0), tail_(file.size()),
+		holder_(file.holder()), file_fd_(file.fd()), file_offset_(file.offset()) {
+	}
+	~Buffer() {
+		if (chunk_.data_) {
+			BufferPool::put(chunk_);
+		}
 	}
 
 	void get_left_space(uint8_t **start, uint32_t *size) 
 	{
-		*start = &data_[tail_];
-		*size = data_.capacity()-tail_; 
+		*start = base_ + tail_;
+		*size = capacity_-tail_; 
 	}
 
 	void peek_cur_data(uint8_t **start, uint32_t *size)
 	{
-		*start = &data_[head_];
+		*start = base_ ? base_ + head_ : NULL;
+		*size = (tail_-head_);
+	}
+	void peek_file(int *fd, off_t *offset, uint32_t *size)
+	{
+		*fd = file_fd_;
+		*offset = file_offset_ + head_;
 		*size = (tail_-head_);
 	}
 	void append_bytes(uint32_t bytes) 
 	{
 		tail_ += bytes;
-		BUG_ON(tail_ > data_.capacity());
+		BUG_ON(tail_ > capacity_);
 	}
 	void consume_bytes(uint32_t bytes) 
 	{
@@ -41,7 +80,7 @@ public:
 	}
 	bool full(void) const 
 	{
-		return ((data_.capacity()-tail_) <= MSG_BUF_MIN_SIZE);
+		return ((capacity_-tail_) <= MSG_BUF_MIN_SIZE);
 	}
 	bool empty(void) const
 	{
@@ -51,20 +90,89 @@ public:
 	{
 		head_ = tail_ = 0;
 	}
+	/* The external buffer could not be reused */
+	bool external(void) const
+	{
+		return (holder_ != nullptr);
+	}
+	bool is_file(void) const
+	{
+		return (file_fd_ != -1);
+	}
+	const shared_ptr<const void> &holder(void) const
+	{
+		return holder_;
+	}
 	
 private:
-	vector<uint8_t> data_;
+	BufferPool::Chunk chunk_;
+	uint8_t *base_;
+	uint32_t capacity_;
 	uint32_t head_;	// The head of data
 	uint32_t tail_; // The tail of data
+	shared_ptr<const void> holder_;
+	int file_fd_;
+	off_t file_offset_;
+};
+
+/* Close the fd taken over by FileSlice */
+class FileHolder: noncopyable {
+public:
+	explicit FileHolder(int fd): fd_(fd) {
+	}
+	~FileHolder() {
+		::close(fd_);
+	}
+private:
+	int fd_;
 };
 
-void PacketBuf::get_left_space(uint8_t **start, uint32_t *size) 
+SharedSlice::SharedSlice(string &&data)
+{
+	shared_ptr<string> holder = make_shared<string>(std::move(data));
+
+	holder_ = holder;
+	data_ = reinterpret_cast<const uint8_t*>(holder->data());
+	size_ = holder->size();
+}
+
+SharedSlice::SharedSlice(vector<uint8_t> &&data)
+{
+	shared_ptr<vector<uint8_t> > holder = make_shared<vector<uint8_t> >(std::move(data));
+
+	holder_ = holder;
+	data_ = holder->data();
+	size_ = holder->size();
+}
+
+SharedSlice SharedSlice::slice(uint32_t offset, uint32_t size) const
+{
+	BUG_ON(offset > size_ || size > size_ - offset);
+	return SharedSlice(holder_, data_ + offset, size);
+}
+
+FileSlice FileSlice::from_fd(int fd, off_t offset, uint64_t size)
+{
+	return FileSlice(make_shared<FileHolder>(fd), fd, offset, size);
+}
+
+FileSlice FileSlice::slice(uint64_t offset, uint64_t size) const
+{
+	BUG_ON(offset > size_ || size > size_ - offset);
+	return FileSlice(holder_, fd_, offset_ + offset, size);
+}
+
+void PacketBuf::get_left_space(uint8_t **start, uint32_t *size, uint32_t size_hint) 
 {		
+	if (bufs_.empty()) {
+		alloc_new_buf(size_hint);
+	}
+
 	BufferPtr buf = bufs_[avail_write_buf_];
 
 	if (buf->full()) {
 		if (avail_write_buf_ == bufs_.size()-1) {
-			alloc_new_buf();
+			alloc_new_buf(size_hint);
 		}
 		avail_write_buf_++;
 		buf = bufs_[avail_write_buf_];
@@ -77,62 +185,518 @@ void PacketBuf::get_left_space(uint8_t **start, uint32_t *size)
 
 void PacketBuf::peek_cur_data(uint8_t **start, uint32_t *size)
 {
-	BufferPtr buf = bufs_[0];
+	if (bufs_.empty()) {
+		*start = NULL;
+		*size = 0;
+		return;
+	}
+
+	BufferPtr &buf = bufs_[0];
 
 	buf->peek_cur_data(start, size);
 }
 
-void PacketBuf::append_bytes(uint32_t bytes) 
+uint32_t PacketBuf::get_left_space_iov(struct iovec *iov, uint32_t iov_cnt, uint32_t size)
 {
-	BufferPtr buf = bufs_[avail_write_buf_];
+	uint32_t cnt = 0;
+	uint32_t total = 0;
+
+	for (uint32_t i = avail_write_buf_; cnt < iov_cnt && total < size; ++i) {
+		uint8_t *start;
+		uint32_t left;
 
-	buf->append_bytes(bytes);
+		if (i == bufs_.size()) {
+			alloc_new_buf(size - total);
+		}
+		bufs_[i]->get_left_space(&start, &left);
+		if (!left) {
+			continue;
+		}
+		left = min(left, size - total);
+		iov[cnt].iov_base = start;
+		iov[cnt].iov_len = left;
+		total += left;
+		cnt++;
+	}
+
+	return cnt;
+}
+
+void PacketBuf::append_bytes(uint32_t bytes) 
+{
 	total_bytes_ += bytes;
+
+	while (bytes) {
+		BufferPtr &buf = bufs_[avail_write_buf_];
+		uint8_t *start;
+		uint32_t left;
+
+		buf->get_left_space(&start, &left);
+		left = min(left, bytes);
+		buf->append_bytes(left);
+		bytes -= left;
+
+		if (bytes) {
+			BUG_ON(avail_write_buf_ + 1 >= bufs_.size());
+			avail_write_buf_++;
+		}
+	}
 }
 
 void PacketBuf::consume_bytes(uint32_t bytes)
 {
-	BufferPtr buf = bufs_[0];
+	BUG_ON(bytes > total_bytes_);
+	total_bytes_ -= bytes;
 
-	buf->consume_bytes(bytes);
-	if (buf->empty()) {
-		buf->reset();
-		if (bufs_.size() > 1) {
-			remove_front_buf();
-			append_new_buf(buf);
+	if (!total_bytes_) {
+		// Return all the memory to the pool at once
+		release_all_bufs();
+		return;
+	}
+
+	// The bytes may span several buffers, i.e. sent by sendmsg
+	uint32_t drained = 0;
+	while (bytes) {
+		BufferPtr &buf = bufs_[drained];
+		uint8_t *start;
+		uint32_t size;
+
+		buf->peek_cur_data(&start, &size);
+		size = min(size, bytes);
+		buf->consume_bytes(size);
+		bytes -= size;
+
+		if (buf->empty()) {
+			drained++;
 		}
 	}
-	total_bytes_ -= bytes;
+
+	// Return the memory to the pool or release the holders
+	if (drained) {
+		bufs_.erase(bufs_.begin(), bufs_.begin() + drained);
+		avail_write_buf_ = (avail_write_buf_ > drained) ? avail_write_buf_ - drained : 0;
+	}
 }
 
-void PacketBuf::alloc_new_buf(void)
-{		
-	BufferPtr buf = std::make_shared<Buffer>();
-	append_new_buf(buf);
+void PacketBuf::release_spare_bufs(void)
+{
+	if (!total_bytes_) {
+		release_all_bufs();
+	} else if (bufs_.size() > avail_write_buf_ + 1) {
+		bufs_.resize(avail_write_buf_ + 1);
+	}
+}
+
+void PacketBuf::append_data(const void *data, uint32_t data_len)
+{
+	const uint8_t *src = reinterpret_cast<const uint8_t*>(data);
+	uint8_t *start;
+	uint32_t size;
+	uint32_t copy_size;
+	uint32_t write_size = 0;
+
+	while (write_size < data_len) {
+		get_left_space(&start, &size, data_len - write_size);
+		copy_size = min(data_len-write_size, size);
+		memcpy(start, src+write_size, copy_size);
+		write_size += copy_size;
+
+		append_bytes(copy_size);
+	}
+}
+
+void PacketBuf::append_slice(const SharedSlice &slice)
+{
+	if (slice.size() <= PACKET_BUF_COPY_MAX_BYTES) {
+		append_data(slice.data(), slice.size());
+		return;
+	}
+
+	insert_buf(make_shared<Buffer>(slice), slice.size());
+}
+
+void PacketBuf::append_packet(PacketBuf &other)
+{
+	for (uint32_t i = 0; i <= other.avail_write_buf_ && i < other.bufs_.size(); ++i) {
+		BufferPtr &buf = other.bufs_[i];
+		uint8_t *start;
+		uint32_t size;
+
+		buf->peek_cur_data(&start, &size);
+		if (size) {
+			insert_buf(buf, size);
+		}
+	}
+
+	other.release_all_bufs();
+	other.total_bytes_ = 0;
+}
+
+void PacketBuf::append_file(const FileSlice &file)
+{
+	for (uint64_t offset = 0; offset < file.size(); offset += PACKET_BUF_FILE_MAX_BYTES) {
+		uint64_t size = min(file.size() - offset, static_cast<uint64_t>(PACKET_BUF_FILE_MAX_BYTES));
+
+		insert_buf(make_shared<Buffer>(file.slice(offset, size)), size);
+	}
 }
 
+bool PacketBuf::peek_file(int *fd, off_t *offset, uint32_t *size)
+{
+	if (bufs_.empty() || !bufs_[0]->is_file()) {
+		return false;
+	}
+	bufs_[0]->peek_file(fd, offset, size);
+	return true;
+}
+
+bool PacketBuf::read_front_file(uint32_t max_bytes)
+{
+	int fd;
+	off_t offset;
+	uint32_t size;
+
+	if (!peek_file(&fd, &offset, &size)) {
+		return true;
+	}
+
+	vector<uint8_t> data(min(size, max_bytes));
+	ssize_t bytes;
+
+	do {
+		bytes = pread(fd, data.data(), data.size(), offset);
+	} while (bytes == -1 && errno == EINTR);
+	if (bytes <= 0) {
+		// The file is truncated if 0
+		return false;
+	}
+	data.resize(bytes);
+
+	// Replace the head of the range with the read bytes
+	SharedSlice slice(std::move(data));
+	bufs_[0]->consume_bytes(bytes);
+	if (bufs_[0]->empty()) {
+		bufs_[0] = make_shared<Buffer>(slice);
+	} else {
+		bufs_.insert(bufs_.begin(), make_shared<Buffer>(slice));
+		avail_write_buf_++;
+	}
+	return true;
+}
 
-bool Conn::read_bytes(void)
+uint8_t *PacketBuf::linearize(uint32_t bytes)
 {
+	if (bytes > total_bytes_ || bufs_.empty()) {
+		return NULL;
+	}
+
+	uint32_t avail = 0;
+
+	// The file range could not be in memory
+	for (uint32_t i = 0; i < bufs_.size() && avail < bytes; ++i) {
+		uint8_t *data;
+		uint32_t len;
+
+		if (bufs_[i]->is_file()) {
+			return NULL;
+		}
+		bufs_[i]->peek_cur_data(&data, &len);
+		avail += len;
+	}
+
+	BufferPtr &head = bufs_[0];
 	uint8_t *start;
 	uint32_t size;
+	uint8_t *tail;
+	uint32_t left;
+
+	head->peek_cur_data(&start, &size);
+	if (size >= bytes) {
+		return start;
+	}
+
+	head->get_left_space(&tail, &left);
+	if (!head->external() && left >= bytes - size) {
+		// Only the missing bytes are copied into the room of the head buffer
+		pull_bytes(1, tail, bytes - size);
+		head->append_bytes(bytes - size);
+		return start;
+	}
+
+	BufferPtr buf;
+
+	if (bytes <= BufferPool::class_bytes(BufferPool::BUF_CLASS_64K)) {
+		buf = make_shared<Buffer>(bytes);
+		buf->get_left_space(&tail, &left);
+		pull_bytes(0, tail, bytes);
+		buf->append_bytes(bytes);
+	} else {
+		vector<uint8_t> data(bytes);
+
+		pull_bytes(0, data.data(), bytes);
+		buf = make_shared<Buffer>(SharedSlice(std::move(data)));
+	}
+
+	// The write buffer stays behind the data, or it is the new one if all are drained
+	bool written = !bufs_.empty() && !bufs_[0]->empty();
+
+	bufs_.insert(bufs_.begin(), buf);
+	avail_write_buf_ = written ? avail_write_buf_ + 1 : 0;
+	buf->peek_cur_data(&start, &size);
+	return start;
+}
+
+uint64_t PacketBuf::peek_range_iov(uint64_t offset, uint64_t size, vector<struct iovec> &iov) const
+{
+	uint64_t base = 0;
+	uint64_t covered = 0;
+
+	for (uint32_t i = 0; i < bufs_.size() && covered < size; ++i) {
+		uint8_t *start;
+		uint32_t len;
+
+		if (bufs_[i]->is_file()) {
+			break;
+		}
+		bufs_[i]->peek_cur_data(&start, &len);
+		if (base + len <= offset) {
+			base += len;
+			continue;
+		}
+
+		uint32_t pos = offset > base ? offset - base : 0;
+		uint64_t piece = min(static_cast<uint64_t>(len - pos), size - covered);
+		struct iovec vec;
+
+		vec.iov_base = start + pos;
+		vec.iov_len = piece;
+		iov.push_back(vec);
+		covered += piece;
+		base += len;
+	}
+
+	return covered;
+}
+
+int64_t PacketBuf::find_bytes(const void *pattern, uint32_t size, uint64_t offset) const
+{
+	const uint8_t *pat = static_cast<const uint8_t*>(pattern);
+	uint64_t base = 0;
+
+	BUG_ON(size == 0);
+	for (uint32_t i = 0; i < bufs_.size(); ++i) {
+		uint8_t *start;
+		uint32_t len;
+
+		if (bufs_[i]->is_file()) {
+			break;
+		}
+		bufs_[i]->peek_cur_data(&start, &len);
+		if (base + len <= offset) {
+			base += len;
+			continue;
+		}
+
+		// memchr is vectorized by libc, the first byte is found by it
+		uint32_t pos = offset > base ? offset - base : 0;
+		while (pos < len) {
+			uint8_t *hit = static_cast<uint8_t*>(memchr(start + pos, pat[0], len - pos));
+
+			if (!hit) {
+				break;
+			}
+			pos = hit - start;
+			if (match_bytes(i, pos + 1, pat + 1, size - 1)) {
+				return base + pos;
+			}
+			pos++;
+		}
+		base += len;
+	}
+
+	return -1;
+}
+
+int PacketBuf::byte_at(uint64_t offset) const
+{
+	uint64_t base = 0;
+
+	for (uint32_t i = 0; i < bufs_.size(); ++i) {
+		uint8_t *start;
+		uint32_t len;
+
+		if (bufs_[i]->is_file()) {
+			break;
+		}
+		bufs_[i]->peek_cur_data(&start, &len);
+		if (offset < base + len) {
+			return start[offset - base];
+		}
+		base += len;
+	}
+
+	return -1;
+}
+
+bool PacketBuf::match_bytes(uint32_t idx, uint32_t pos, const uint8_t *pattern, uint32_t size) const
+{
+	for (uint32_t i = idx; i < bufs_.size() && size; ++i, pos = 0) {
+		uint8_t *start;
+		uint32_t len;
+
+		if (bufs_[i]->is_file()) {
+			return false;
+		}
+		bufs_[i]->peek_cur_data(&start, &len);
+		if (pos >= len) {
+			continue;
+		}
+
+		uint32_t cmp = min(len - pos, size);
+		if (memcmp(start + pos, pattern, cmp)) {
+			return false;
+		}
+		pattern += cmp;
+		size -= cmp;
+	}
+
+	return size == 0;
+}
+
+void PacketBuf::pull_bytes(uint32_t first, uint8_t *dst, uint32_t bytes)
+{
+	uint32_t pos = first;
+
+	while (bytes) {
+		BufferPtr &buf = bufs_[pos];
+		uint8_t *start;
+		uint32_t size;
+
+		buf->peek_cur_data(&start, &size);
+		size = min(size, bytes);
+		memcpy(dst, start, size);
+		buf->consume_bytes(size);
+		dst += size;
+		bytes -= size;
+
+		if (buf->empty()) {
+			pos++;
+		}
+	}
+
+	if (pos > first) {
+		uint32_t drained = pos - first;
+
+		bufs_.erase(bufs_.begin() + first, bufs_.begin() + pos);
+		if (avail_write_buf_ >= pos) {
+			avail_write_buf_ -= drained;
+		} else if (avail_write_buf_ >= first) {
+			// The write buffer is drained, the following ones are empty
+			avail_write_buf_ = first ? first - 1 : 0;
+		}
+	}
+}
+
+void PacketBuf::insert_buf(const BufferPtr &buf, uint32_t bytes)
+{
+	// The empty write buffer is moved after the new one, the data is always in order
+	uint32_t pos = (bufs_.empty() || bufs_[avail_write_buf_]->empty()) ? avail_write_buf_ : avail_write_buf_ + 1;
+
+	bufs_.insert(bufs_.begin() + pos, buf);
+	avail_write_buf_ = pos;
+	total_bytes_ += bytes;
+}
+
+uint32_t PacketBuf::peek_data_iov(struct iovec *iov, uint32_t iov_cnt)
+{
+	uint32_t cnt = 0;
+
+	for (uint32_t i = 0; i <= avail_write_buf_ && i < bufs_.size() && cnt < iov_cnt; ++i) {
+		uint8_t *start;
+		uint32_t size;
+
+		if (bufs_[i]->is_file()) {
+			break;
+		}
+		bufs_[i]->peek_cur_data(&start, &size);
+		if (!size) {
+			continue;
+		}
+		iov[cnt].iov_base = start;
+		iov[cnt].iov_len = size;
+		cnt++;
+	}
+
+	return cnt;
+}
+
+uint32_t PacketBuf::peek_slice_iov(struct iovec *iov, uint32_t iov_cnt, vector<shared_ptr<const void> > &holders)
+{
+	uint32_t cnt = 0;
+
+	for (uint32_t i = 0; i <= avail_write_buf_ && i < bufs_.size() && cnt < iov_cnt; ++i) {
+		uint8_t *start;
+		uint32_t size;
+
+		// The owned buffer is reused after consumed, it could not be sent by zero copy
+		if (!bufs_[i]->external() || bufs_[i]->is_file()) {
+			break;
+		}
+		bufs_[i]->peek_cur_data(&start, &size);
+		if (!size) {
+			continue;
+		}
+		iov[cnt].iov_base = start;
+		iov[cnt].iov_len = size;
+		holders.push_back(bufs_[i]->holder());
+		cnt++;
+	}
+
+	return cnt;
+}
+
+void PacketBuf::alloc_new_buf(uint32_t size_hint)
+{		
+	BufferPtr buf = std::make_shared<Buffer>(size_hint);
+	append_new_buf(buf);
+}
+
+
+ssize_t Conn::read_bytes(uint32_t size)
+{
+	struct iovec iov[CONN_READ_IOV_MAX];
+	uint32_t iov_cnt;
 	ssize_t bytes;
 
-	rcv_buf_->get_left_space(&start, &size);
+	iov_cnt = rcv_buf_->get_left_space_iov(iov, CONN_READ_IOV_MAX, size ? size : CONN_DEFAULT_READ_BYTES);
 
-	bytes = recv(fd_, start, size, MSG_DONTWAIT);
+	bytes = readv(fd_, iov, iov_cnt);
 	if (-1 == bytes) {
-        LOG_WARN("conn(%s) read -1 bytes", to_str());
-		return false;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			LOG_WARN("conn(%s) read -1 bytes: %s", to_str(), strerror(errno));
+		}
+		rcv_buf_->release_spare_bufs();
+		return bytes;
 	} else if (0 == bytes) {
         LOG_WARN("conn(%s) closed by peer", to_str());
-		return false;
+		rcv_buf_->release_spare_bufs();
+		return bytes;
 	}
-    LOG_DBUG("recv from fd:%d", fd_);
-    LOG_DUMP("recv", start, bytes);
+    LOG_DBUG("recv %d bytes from fd:%d", bytes, fd_);
+    LOG_DUMP("recv", iov[0].iov_base, min(static_cast<size_t>(bytes), iov[0].iov_len));
 
 	rcv_buf_->append_bytes(bytes);
-	return true;
+	return bytes;
+}
+
+int Conn::get_readable_bytes(void) const
+{
+	int bytes;
+
+	if (ioctl(fd_, FIONREAD, &bytes) == -1) {
+		return -1;
+	}
+	return bytes;
 }
 
 void Conn::write_bytes(string &data)
@@ -142,42 +706,102 @@ void Conn::write_bytes(string &data)
 
 void Conn::write_bytes(void *data, uint32_t data_len)
 {
-	uint8_t *start;
-	uint32_t size;
-	uint8_t *write_start;
-	uint32_t write_size;
-	uint32_t copy_size;
-	uint32_t left_size;
+	send_buf_->append_data(data, data_len);
+    LOG_DBUG("Conn(%s) writes %d bytes", to_str(), data_len);
+}
 
-	write_start = reinterpret_cast<uint8_t*>(data);
-	write_size = 0;
+void Conn::write_bytes(string &&data)
+{
+	uint32_t data_len = data.size();
 
-	while (write_size < data_len) {
-		send_buf_->get_left_space(&start, &size);
-		left_size = data_len-write_size;
-		copy_size = min(left_size, size);
-		memcpy(start, write_start+write_size, copy_size);
-		write_size += copy_size;
+	if (data_len <= PacketBuf::PACKET_BUF_COPY_MAX_BYTES) {
+		write_bytes(&data[0], data_len);
+		return;
+	}
+	send_buf_->append_slice(SharedSlice(std::move(data)));
+    LOG_DBUG("Conn(%s) writes %d bytes", to_str(), data_len);
+}
+
+void Conn::write_bytes(vector<uint8_t> &&data)
+{
+	uint32_t data_len = data.size();
 
-		send_buf_->append_bytes(copy_size);
+	if (data_len <= PacketBuf::PACKET_BUF_COPY_MAX_BYTES) {
+		write_bytes(data.data(), data_len);
+		return;
 	}
-    LOG_DBUG("Conn(%s) writes %d bytes", to_str(), write_size);
+	send_buf_->append_slice(SharedSlice(std::move(data)));
+    LOG_DBUG("Conn(%s) writes %d bytes", to_str(), data_len);
+}
+
+void Conn::write_bytes(const SharedSlice &data)
+{
+	send_buf_->append_slice(data);
+    LOG_DBUG("Conn(%s) writes %d bytes", to_str(), data.size());
+}
+
+void Conn::write_file(const FileSlice &file)
+{
+	send_buf_->append_file(file);
+    LOG_DBUG("Conn(%s) writes file %lu bytes", to_str(), file.size());
 }
 
-void Conn::send_bytes(void)
+void Conn::fill_rcv_bytes(const void *data, uint32_t data_len)
 {
-	uint8_t *data;
-	uint32_t data_len;
+	rcv_buf_->append_data(data, data_len);
+    LOG_DBUG("recv from fd:%d", fd_);
+    LOG_DUMP("recv", data, data_len);
+}
+
+uint64_t Conn::send_bytes(void)
+{
+	struct iovec iov[CONN_SEND_IOV_MAX];
+	struct msghdr msg;
+	vector<shared_ptr<const void> > holders;
+	bool zerocopy_enabled = (zerocopy_threshold_ != 0);
+	uint64_t sent = 0;
 	ssize_t bytes;
 
-	do {
-		send_buf_->peek_cur_data(&data, &data_len);
-		if (data_len == 0) {
-			break;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+
+	while (!send_buf_->empty()) {
+		int file_fd;
+		off_t file_offset;
+		uint32_t size = 0;
+		bool file = send_buf_->peek_file(&file_fd, &file_offset, &size);
+		bool zerocopy = false;
+
+		if (file) {
+			bytes = sendfile(fd_, file_fd, &file_offset, size);
+		} else {
+			if (zerocopy_enabled) {
+				holders.clear();
+				msg.msg_iovlen = send_buf_->peek_slice_iov(iov, CONN_SEND_IOV_MAX, holders);
+				for (size_t i = 0; i < msg.msg_iovlen; ++i) {
+					size += iov[i].iov_len;
+				}
+				zerocopy = (size && size >= zerocopy_threshold_);
+			}
+			if (!zerocopy) {
+				size = 0;
+				msg.msg_iovlen = send_buf_->peek_data_iov(iov, CONN_SEND_IOV_MAX);
+				for (size_t i = 0; i < msg.msg_iovlen; ++i) {
+					size += iov[i].iov_len;
+				}
+			}
+			bytes = sendmsg(fd_, &msg, MSG_DONTWAIT|MSG_NOSIGNAL|(zerocopy ? MSG_ZEROCOPY : 0));
 		}
-		bytes = send(fd_, data, data_len, MSG_DONTWAIT);
+
 		if (-1 == bytes) {
 			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				// Wait for EPOLLOUT instead of spinning on the full socket
+				break;
+			} else if (errno == EINTR) {
+				continue;
+			} else if (errno == ENOBUFS && zerocopy) {
+				// The optmem limit is reached, copy them this time
+				zerocopy_enabled = false;
 				continue;
 			} else if (errno == ECONNRESET || errno == EPIPE) {
 				// The conn is reset or interrupted by accident
@@ -187,12 +811,113 @@ void Conn::send_bytes(void)
 				break;
 			} else {
                 LOG_WARN("send failed:%s", strerror(errno));
+				if (file) {
+					// The stream could not skip the file range
+					force_close();
+				}
 				break;
 			}
+		} else if (0 == bytes && file) {
+			LOG_ERRO("conn(%s) the file is truncated, force close it", to_str());
+			force_close();
+			break;
+		}
+
+		if (zerocopy) {
+			// The kernel numbers every successful zero copy send
+			zerocopy_sends_.emplace_back();
+			zerocopy_sends_.back().seq_ = zerocopy_seq_++;
+			zerocopy_sends_.back().holders_.swap(holders);
 		}
 		send_buf_->consume_bytes(bytes);
+		sent += bytes;
         LOG_DBUG("Conn(%s) sends %d bytes", to_str(), bytes);
-	} while (1);
+
+		if (static_cast<size_t>(bytes) < size) {
+			// The socket is full, no need to get EAGAIN
+			break;
+		}
+	}
+
+	return sent;
+}
+
+bool Conn::set_zerocopy_threshold(uint32_t bytes)
+{
+	int enable = 1;
+
+	if (bytes && !zerocopy_threshold_ && setsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == -1) {
+		LOG_WARN("conn(%s) fail to enable SO_ZEROCOPY: %s", to_str(), strerror(errno));
+		return false;
+	}
+	zerocopy_threshold_ = bytes;
+	return true;
+}
+
+void Conn::reap_zerocopy(void)
+{
+	char control[128];
+	struct msghdr msg;
+
+	while (!zerocopy_sends_.empty()) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(fd_, &msg, MSG_ERRQUEUE|MSG_DONTWAIT) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+				(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) {
+				continue;
+			}
+
+			struct sock_extended_err *serr = reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cmsg));
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+				continue;
+			}
+
+			// The sends in [ee_info, ee_data] are completed, the TCP completions are in order
+			uint32_t hi = serr->ee_data;
+			auto it = zerocopy_sends_.begin();
+			while (it != zerocopy_sends_.end() && static_cast<int32_t>(it->seq_ - hi) <= 0) {
+				++it;
+			}
+			zerocopy_sends_.erase(zerocopy_sends_.begin(), it);
+		}
+	}
+}
+
+void Conn::abort_zerocopy(void)
+{
+	reap_zerocopy();
+	if (zerocopy_sends_.empty()) {
+		return;
+	}
+
+	struct linger lg;
+
+	lg.l_onoff = 1;
+	lg.l_linger = 0;
+	if (setsockopt(fd_, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg)) == -1) {
+		LOG_WARN("conn(%s) fail to reset for the zero copy sends: %s", to_str(), strerror(errno));
+	}
+	zerocopy_sends_.clear();
+}
+
+int Conn::get_inflight_bytes(void) const
+{
+	int bytes;
+
+	if (ioctl(fd_, SIOCOUTQ, &bytes) == -1) {
+		return -1;
+	}
+	return bytes;
 }
 
 bool Conn::rcv_buf_empty(void) const
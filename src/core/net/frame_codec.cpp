@@ -0,0 +1,141 @@
+#include <string.h>
+
+#include "base/utils/compiler.hpp"
+#include "base/utils/ik_logger.h"
+#include "core/net/frame_codec.hpp"
+
+using namespace std;
+
+namespace cppbase {
+
+void Frame::copy_payload(void *dst) const
+{
+	uint8_t *pos = static_cast<uint8_t*>(dst);
+
+	for (auto it = payload_.begin(); it != payload_.end(); ++it) {
+		memcpy(pos, it->iov_base, it->iov_len);
+		pos += it->iov_len;
+	}
+}
+
+string Frame::payload_str(void) const
+{
+	string data;
+
+	data.reserve(payload_size_);
+	for (auto it = payload_.begin(); it != payload_.end(); ++it) {
+		data.append(static_cast<const char*>(it->iov_base), it->iov_len);
+	}
+	return data;
+}
+
+LengthFieldCodec::LengthFieldCodec(uint32_t header_bytes, uint32_t field_offset, uint32_t field_bytes,
+	int32_t length_adjust, uint32_t max_frame_bytes): FrameCodec(max_frame_bytes), header_bytes_(header_bytes),
+	field_offset_(field_offset), field_bytes_(field_bytes), length_adjust_(length_adjust)
+{
+	BUG_ON(field_bytes != 1 && field_bytes != 2 && field_bytes != 4);
+	BUG_ON(field_offset + field_bytes > header_bytes);
+}
+
+FrameCodec::DecodeResult LengthFieldCodec::decode(PacketBuf &buf, uint64_t &scanned, FrameRange &range) const
+{
+	const uint8_t *header = buf.linearize(header_bytes_);
+
+	if (!header) {
+		return FRAME_DECODE_MORE;
+	}
+
+	int64_t length = 0;
+	for (uint32_t i = 0; i < field_bytes_; ++i) {
+		length = (length << 8) | header[field_offset_ + i];
+	}
+	length += length_adjust_;
+
+	if (length < 0 || header_bytes_ + length > max_frame_bytes_) {
+		LOG_WARN("Invalid frame length: %ld", length);
+		return FRAME_DECODE_ERROR;
+	}
+	if (buf.total_size() < header_bytes_ + static_cast<uint64_t>(length)) {
+		return FRAME_DECODE_MORE;
+	}
+
+	range.header_bytes_ = header_bytes_;
+	range.payload_bytes_ = length;
+	range.trailer_bytes_ = 0;
+	return FRAME_DECODE_OK;
+}
+
+FrameCodec::DecodeResult VarintCodec::decode(PacketBuf &buf, uint64_t &scanned, FrameRange &range) const
+{
+	uint32_t avail = min(buf.total_size(), static_cast<uint64_t>(VARINT_MAX_BYTES));
+	const uint8_t *header = buf.linearize(avail);
+
+	if (!header) {
+		return FRAME_DECODE_MORE;
+	}
+
+	uint64_t length = 0;
+	uint32_t i;
+
+	for (i = 0; i < avail; ++i) {
+		length |= static_cast<uint64_t>(header[i] & 0x7f) << (i * 7);
+		if (!(header[i] & 0x80)) {
+			break;
+		}
+	}
+	if (i == avail) {
+		if (avail < VARINT_MAX_BYTES) {
+			return FRAME_DECODE_MORE;
+		}
+		LOG_WARN("The varint length is longer than %u bytes", VARINT_MAX_BYTES);
+		return FRAME_DECODE_ERROR;
+	}
+
+	uint32_t header_bytes = i + 1;
+	if (header_bytes + length > max_frame_bytes_) {
+		LOG_WARN("Invalid frame length: %lu", length);
+		return FRAME_DECODE_ERROR;
+	}
+	if (buf.total_size() < header_bytes + length) {
+		return FRAME_DECODE_MORE;
+	}
+
+	range.header_bytes_ = header_bytes;
+	range.payload_bytes_ = length;
+	range.trailer_bytes_ = 0;
+	return FRAME_DECODE_OK;
+}
+
+DelimiterCodec::DelimiterCodec(const string &delimiter, uint32_t max_frame_bytes): FrameCodec(max_frame_bytes),
+	delimiter_(delimiter)
+{
+	BUG_ON(delimiter_.empty());
+}
+
+FrameCodec::DecodeResult DelimiterCodec::decode(PacketBuf &buf, uint64_t &scanned, FrameRange &range) const
+{
+	int64_t pos = buf.find_bytes(delimiter_.data(), delimiter_.size(), scanned);
+
+	if (pos == -1) {
+		// The tail may be the head of the delimiter, it is scanned again with the new bytes
+		uint64_t total = buf.total_size();
+
+		scanned = (total >= delimiter_.size()) ? total - delimiter_.size() + 1 : 0;
+		if (total > max_frame_bytes_) {
+			LOG_WARN("No delimiter in %lu bytes", total);
+			return FRAME_DECODE_ERROR;
+		}
+		return FRAME_DECODE_MORE;
+	}
+	if (pos + delimiter_.size() > max_frame_bytes_) {
+		LOG_WARN("Invalid frame length: %ld", pos);
+		return FRAME_DECODE_ERROR;
+	}
+
+	range.header_bytes_ = 0;
+	range.payload_bytes_ = pos;
+	range.trailer_bytes_ = delimiter_.size();
+	return FRAME_DECODE_OK;
+}
+
+}
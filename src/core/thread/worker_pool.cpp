@@ -0,0 +1,103 @@
+#include <stdio.h>
+
+#include "core/thread/worker_pool.hpp"
+
+using namespace std;
+
+namespace cppbase {
+
+WorkerPool::WorkerPool(uint32_t worker_cnt, const string &name, bool set_cpu)
+	: thr_pool_(set_cpu), name_(name), started_(false)
+{
+	if (!worker_cnt) {
+		worker_cnt = 1;
+	}
+	for (uint32_t i = 0; i < worker_cnt; ++i) {
+		workers_.emplace_back(new Worker());
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	stop();
+}
+
+void WorkerPool::start(void)
+{
+	if (started_) {
+		return;
+	}
+
+	for (uint32_t i = 0; i < workers_.size(); ++i) {
+		char name[32];
+
+		snprintf(name, sizeof(name), "%s%u", name_.c_str(), i);
+		// The signals are handled by the server threads
+		ThreadPtr thread = make_shared<Thread>(bind(&WorkerPool::run_worker, this, placeholders::_1),
+			workers_[i].get(), name, false, true);
+		thr_pool_.append_thread(thread);
+	}
+	thr_pool_.start_all_threads();
+	started_ = true;
+}
+
+void WorkerPool::stop(void)
+{
+	if (!started_) {
+		return;
+	}
+
+	for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+		LockGuard<Mutex> guard((*it)->lock_);
+
+		(*it)->stop_ = true;
+		(*it)->cond_.notify();
+	}
+	thr_pool_.wait_all_threads_stoped();
+	started_ = false;
+}
+
+void WorkerPool::dispatch(uint32_t key, const Task &task)
+{
+	Worker *worker = get_worker(key);
+	LockGuard<Mutex> guard(worker->lock_);
+
+	worker->tasks_.push_back(task);
+	worker->cond_.notify();
+}
+
+void WorkerPool::dispatch(uint32_t key, Task &&task)
+{
+	Worker *worker = get_worker(key);
+	LockGuard<Mutex> guard(worker->lock_);
+
+	worker->tasks_.push_back(std::move(task));
+	worker->cond_.notify();
+}
+
+void WorkerPool::run_worker(void *data)
+{
+	Worker *worker = static_cast<Worker*>(data);
+
+	while (true) {
+		Task task;
+
+		{
+			LockGuard<Mutex> guard(worker->lock_);
+
+			while (worker->tasks_.empty() && !worker->stop_) {
+				worker->cond_.wait();
+			}
+			if (worker->tasks_.empty()) {
+				// Stopped
+				return;
+			}
+			task = std::move(worker->tasks_.front());
+			worker->tasks_.pop_front();
+		}
+
+		task();
+	}
+}
+
+}
@@ -0,0 +1,143 @@
+/*
+Report the memory cost of the idle conns of TCPServer.
+The server runs in a thread, the clients connect to it without sending any byte.
+The heap bytes are got by mallinfo2, the pool bytes are the chunks cached by BufferPool.
+
+Usage: idle_conn_bench [conn_cnt] [port]
+*/
+#include <arpa/inet.h>
+#include <malloc.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "base/server/task_server.hpp"
+#include "base/utils/ik_logger.h"
+#include "core/net/buffer_pool.hpp"
+
+using namespace cppbase;
+
+static size_t heap_bytes(void)
+{
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+}
+
+static size_t rss_bytes(void)
+{
+	long pages = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+
+	if (fp) {
+		if (fscanf(fp, "%*ld %ld", &pages) != 1) {
+			pages = 0;
+		}
+		fclose(fp);
+	}
+	return pages * sysconf(_SC_PAGESIZE);
+}
+
+/* Run the function in the loop thread and wait for the result */
+template <typename T>
+static T run_in_server(TCPServer &server, const std::function<T (void)> &fn)
+{
+	std::promise<T> result;
+
+	server.post([&result, &fn]() {
+		result.set_value(fn());
+	});
+	return result.get_future().get();
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t conn_cnt = argc > 1 ? atoi(argv[1]) : 10000;
+	uint16_t port = argc > 2 ? atoi(argv[2]) : 19500;
+	struct rlimit limit;
+
+	reset_log_level("error");
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < conn_cnt * 2 + 64) {
+		limit.rlim_cur = std::min<rlim_t>(conn_cnt * 2 + 64, limit.rlim_max);
+		setrlimit(RLIMIT_NOFILE, &limit);
+		if (limit.rlim_cur < conn_cnt * 2 + 64) {
+			conn_cnt = (limit.rlim_cur - 64) / 2;
+			printf("The conn count is limited to %u by RLIMIT_NOFILE\n", conn_cnt);
+		}
+	}
+
+	TCPServer server(INADDR_LOOPBACK, port);
+	std::atomic<bool> stop(false);
+
+	server.set_exit_callback([&stop]() {
+		return stop.load();
+	});
+	server.set_msg_callback([](const ConnPtr &conn, PacketBufPtr &msg) {
+		msg->consume_bytes(msg->total_size());
+	});
+	if (!server.init()) {
+		fprintf(stderr, "Fail to init the server on port %u\n", port);
+		return 1;
+	}
+	std::thread loop([&server]() {
+		server.start(NULL);
+	});
+
+	// Warm up the loop and the containers of the server
+	std::function<uint32_t (void)> conn_cnt_fn = [&server]() { return server.get_conn_cnt(); };
+	std::function<size_t (void)> pool_fn = []() { return BufferPool::cached_bytes(); };
+	run_in_server(server, conn_cnt_fn);
+
+	std::vector<int> clients;
+	struct sockaddr_in addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	clients.reserve(conn_cnt);
+
+	size_t heap_before = heap_bytes();
+	size_t rss_before = rss_bytes();
+	size_t pool_before = run_in_server(server, pool_fn);
+
+	for (uint32_t i = 0; i < conn_cnt; ++i) {
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (fd == -1 || connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+			perror("Fail to connect");
+			return 1;
+		}
+		clients.push_back(fd);
+	}
+	while (run_in_server(server, conn_cnt_fn) < conn_cnt) {
+		usleep(10000);
+	}
+
+	size_t heap = heap_bytes() - heap_before;
+	size_t rss = rss_bytes() - rss_before;
+	size_t pool = run_in_server(server, pool_fn) - pool_before;
+
+	printf("idle conns: %u\n", conn_cnt);
+	printf("heap bytes per conn: %.1f\n", static_cast<double>(heap) / conn_cnt);
+	printf("pool bytes per conn: %.1f\n", static_cast<double>(pool) / conn_cnt);
+	printf("rss bytes per conn: %.1f\n", static_cast<double>(rss) / conn_cnt);
+
+	for (auto it = clients.begin(); it != clients.end(); ++it) {
+		close(*it);
+	}
+	// Wake up the loop to check the exit
+	stop.store(true);
+	server.post([]() {});
+	loop.join();
+
+	return 0;
+}
@@ -0,0 +1,118 @@
+#include "unittest.hpp"
+#include "core/net/buffer_pool.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using cppbase::BufferPool;
+
+TEST(BufferPoolTest, SizeClass) {
+	EXPECT_EQ(BufferPool::size_class(0), BufferPool::BUF_CLASS_1K);
+	EXPECT_EQ(BufferPool::size_class(1024), BufferPool::BUF_CLASS_1K);
+	EXPECT_EQ(BufferPool::size_class(1025), BufferPool::BUF_CLASS_4K);
+	EXPECT_EQ(BufferPool::size_class(16384), BufferPool::BUF_CLASS_16K);
+	EXPECT_EQ(BufferPool::size_class(1 << 20), BufferPool::BUF_CLASS_64K);
+	EXPECT_EQ(BufferPool::class_bytes(BufferPool::BUF_CLASS_64K), 65536U);
+}
+
+TEST(BufferPoolTest, Reuse) {
+	size_t cached = BufferPool::cached_bytes();
+	BufferPool::Chunk chunk = BufferPool::get(BufferPool::BUF_CLASS_4K);
+	uint8_t *data = chunk.data_;
+
+	ASSERT_TRUE(data != NULL);
+	BufferPool::put(chunk);
+	EXPECT_GE(BufferPool::cached_bytes(), cached + 4096);
+
+	chunk = BufferPool::get(BufferPool::BUF_CLASS_4K);
+	EXPECT_EQ(chunk.data_, data);
+	BufferPool::put(chunk);
+}
+
+TEST(BufferPoolTest, HugepageSlab) {
+	std::thread thr([]() {
+		BufferPool::set_hugepage_slabs(true);
+		BufferPool::Chunk chunk = BufferPool::get(BufferPool::BUF_CLASS_64K);
+		BufferPool::set_hugepage_slabs(false);
+
+		ASSERT_TRUE(chunk.slab_);
+		// The rest of the slab is cached
+		EXPECT_EQ(BufferPool::cached_bytes(), BufferPool::BUF_POOL_SLAB_BYTES - 65536U);
+		chunk.data_[65535] = 1;
+		BufferPool::put(chunk);
+		EXPECT_EQ(BufferPool::cached_bytes(), static_cast<size_t>(BufferPool::BUF_POOL_SLAB_BYTES));
+	});
+	thr.join();
+}
+
+TEST(BufferPoolTest, PutAfterThreadExit) {
+	BufferPool::Chunk chunk;
+	std::thread thr([&chunk]() {
+		chunk = BufferPool::get(BufferPool::BUF_CLASS_1K);
+	});
+	thr.join();
+
+	// It is cached by the current thread
+	size_t cached = BufferPool::cached_bytes();
+	BufferPool::put(chunk);
+	EXPECT_EQ(BufferPool::cached_bytes(), cached + 1024);
+	BufferPool::put(BufferPool::get(BufferPool::BUF_CLASS_1K));
+}
+
+TEST(BufferPoolTest, SlabFreedByOtherThread) {
+	// Like the offloaded messages, one thread gets the chunks and another one puts them
+	std::mutex lock;
+	std::condition_variable cond;
+	std::vector<BufferPool::Chunk> handoff;
+	bool done = false;
+
+	std::thread freer([&]() {
+		std::unique_lock<std::mutex> guard(lock);
+
+		while (true) {
+			cond.wait(guard, [&]() { return done || !handoff.empty(); });
+			if (handoff.empty()) {
+				break;
+			}
+			for (auto it = handoff.begin(); it != handoff.end(); ++it) {
+				BufferPool::put(*it);
+			}
+			handoff.clear();
+			cond.notify_all();
+		}
+	});
+
+	size_t carved = 0;
+	std::thread getter([&]() {
+		BufferPool::set_hugepage_slabs(true);
+		size_t start = BufferPool::slab_bytes();
+
+		for (int round = 0; round < 50; ++round) {
+			std::vector<BufferPool::Chunk> chunks;
+
+			for (int i = 0; i < 64; ++i) {
+				chunks.push_back(BufferPool::get(BufferPool::BUF_CLASS_64K));
+				chunks.back().data_[0] = 1;
+			}
+			std::unique_lock<std::mutex> guard(lock);
+			cond.wait(guard, [&]() { return handoff.empty(); });
+			handoff.swap(chunks);
+			cond.notify_all();
+		}
+		carved = BufferPool::slab_bytes() - start;
+		BufferPool::set_hugepage_slabs(false);
+	});
+	getter.join();
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		done = true;
+		cond.notify_all();
+	}
+	freer.join();
+
+	// The chunks in use, in the handoff and in the caches of both threads, not one slab per round
+	EXPECT_LE(carved, 4U * BufferPool::BUF_POOL_CACHE_BYTES);
+}
@@ -0,0 +1,105 @@
+#include "unittest.hpp"
+#include "core/net/frame_codec.hpp"
+
+#include <string>
+
+using cppbase::PacketBuf;
+using cppbase::SharedSlice;
+using cppbase::Frame;
+using cppbase::FrameCodec;
+using cppbase::LengthFieldCodec;
+using cppbase::VarintCodec;
+using cppbase::DelimiterCodec;
+
+static std::string payload(PacketBuf &buf, const FrameCodec::FrameRange &range)
+{
+	Frame frame;
+
+	buf.peek_range_iov(range.header_bytes_, range.payload_bytes_, frame.payload_);
+	frame.payload_size_ = range.payload_bytes_;
+	return frame.payload_str();
+}
+
+TEST(FrameCodecTest, FindBytes) {
+	PacketBuf buf;
+
+	buf.append_data("abc\r", 4);
+	buf.append_slice(SharedSlice{std::string(1000, 'x') + "\r\n"});
+	EXPECT_EQ(buf.find_bytes("\r\n", 2), 1004);
+	EXPECT_EQ(buf.find_bytes("c\rx", 3), 2);
+	EXPECT_EQ(buf.find_bytes("\r\n", 2, 1005), -1);
+	EXPECT_EQ(buf.find_bytes("y", 1), -1);
+
+	EXPECT_EQ(buf.byte_at(0), 'a');
+	EXPECT_EQ(buf.byte_at(3), '\r');
+	EXPECT_EQ(buf.byte_at(4), 'x');
+	EXPECT_EQ(buf.byte_at(1005), '\n');
+	EXPECT_EQ(buf.byte_at(1006), -1);
+}
+
+TEST(FrameCodecTest, LengthField) {
+	LengthFieldCodec codec(6, 2, 4);
+	PacketBuf buf;
+	FrameCodec::FrameRange range;
+	uint64_t scanned = 0;
+	std::string body(3000, 'p');
+	const uint8_t header[] = {'T', 'Y', 0, 0, 0x0b, 0xb8};
+
+	// The header spans the buffers
+	buf.append_data(header, 3);
+	EXPECT_EQ(codec.decode(buf, scanned, range), FrameCodec::FRAME_DECODE_MORE);
+	buf.append_slice(SharedSlice{std::string(reinterpret_cast<const char*>(header) + 3, 3) + body.substr(0, 1000)});
+	EXPECT_EQ(codec.decode(buf, scanned, range), FrameCodec::FRAME_DECODE_MORE);
+	buf.append_data(body.data() + 1000, 2000);
+	ASSERT_EQ(codec.decode(buf, scanned, range), FrameCodec::FRAME_DECODE_OK);
+	EXPECT_EQ(range.header_bytes_, 6U);
+	EXPECT_EQ(range.payload_bytes_, 3000U);
+	EXPECT_EQ(payload(buf, range), body);
+
+	LengthFieldCodec small(2, 0, 2, 0, 100);
+	PacketBuf big;
+	big.append_data("\x01\x00", 2);
+	EXPECT_EQ(small.decode(big, scanned, range), FrameCodec::FRAME_DECODE_ERROR);
+}
+
+TEST(FrameCodecTest, Varint) {
+	VarintCodec codec;
+	PacketBuf buf;
+	FrameCodec::FrameRange range;
+	uint64_t scanned = 0;
+	std::string body(300, 'v');
+
+	// 300 is 0xac 0x02
+	buf.append_data("\xac", 1);
+	EXPECT_EQ(codec.decode(buf, scanned, range), FrameCodec::FRAME_DECODE_MORE);
+	buf.append_data("\x02", 1);
+	buf.append_data(body.data(), body.size());
+	ASSERT_EQ(codec.decode(buf, scanned, range), FrameCodec::FRAME_DECODE_OK);
+	EXPECT_EQ(range.header_bytes_, 2U);
+	EXPECT_EQ(payload(buf, range), body);
+
+	PacketBuf bad;
+	bad.append_data("\xff\xff\xff\xff\xff\x01", 6);
+	EXPECT_EQ(codec.decode(bad, scanned, range), FrameCodec::FRAME_DECODE_ERROR);
+}
+
+TEST(FrameCodecTest, Delimiter) {
+	DelimiterCodec codec("\r\n", 4096);
+	PacketBuf buf;
+	FrameCodec::FrameRange range;
+	uint64_t scanned = 0;
+
+	buf.append_data("hello\r", 6);
+	EXPECT_EQ(codec.decode(buf, scanned, range), FrameCodec::FRAME_DECODE_MORE);
+	EXPECT_EQ(scanned, 5U);
+	buf.append_slice(SharedSlice{"\n" + std::string(600, 'n')});
+	ASSERT_EQ(codec.decode(buf, scanned, range), FrameCodec::FRAME_DECODE_OK);
+	EXPECT_EQ(range.payload_bytes_, 5U);
+	EXPECT_EQ(range.trailer_bytes_, 2U);
+	EXPECT_EQ(payload(buf, range), "hello");
+
+	buf.consume_bytes(7);
+	scanned = 0;
+	buf.append_data(std::string(4000, 'n').data(), 4000);
+	EXPECT_EQ(codec.decode(buf, scanned, range), FrameCodec::FRAME_DECODE_ERROR);
+}
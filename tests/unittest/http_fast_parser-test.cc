@@ -0,0 +1,97 @@
+#include "unittest.hpp"
+#include "base/server/http_fast_parser.hpp"
+
+#include <string>
+
+using cppbase::StrView;
+using cppbase::HTTPFastParser;
+using cppbase::HTTPRequestHead;
+using cppbase::HTTPChunkedDecoder;
+
+static int parse(const std::string &req, HTTPRequestHead &head)
+{
+	return HTTPFastParser::parse_request(req.data(), req.size(), head);
+}
+
+TEST(HTTPFastParserTest, Request) {
+	// The long value is scanned by the SIMD codes and the tail by the scalar loop
+	std::string value(100, 'v');
+	std::string req = "GET /index.html?a=1 HTTP/1.1\r\nHost: example.com\r\nX-Long:  " + value + " \t\r\n"
+		"X|Pipe~: \r\n\r\nbody";
+	HTTPRequestHead head;
+
+	for (int simd = 0; simd < 2; ++simd) {
+		HTTPFastParser::enable_simd(simd);
+		ASSERT_EQ(parse(req, head), static_cast<int>(req.size() - 4));
+		EXPECT_TRUE(head.method_ == "GET");
+		EXPECT_TRUE(head.path_ == "/index.html?a=1");
+		EXPECT_EQ(head.minor_version_, 1);
+		ASSERT_EQ(head.header_cnt_, 3U);
+		EXPECT_TRUE(head.headers_[0].name_ == "Host");
+		EXPECT_TRUE(head.headers_[0].value_ == "example.com");
+		EXPECT_TRUE(head.headers_[1].value_ == StrView(value));
+		EXPECT_TRUE(head.headers_[2].name_ == "X|Pipe~");
+		EXPECT_TRUE(head.headers_[2].value_.empty());
+	}
+	HTTPFastParser::enable_simd(true);
+
+	// Any prefix of the head is incomplete
+	for (size_t i = 0; i < req.size() - 4; ++i) {
+		EXPECT_EQ(HTTPFastParser::parse_request(req.data(), i, head), HTTPFastParser::HTTP_HEAD_INCOMPLETE);
+	}
+	EXPECT_EQ(parse("\r\nGET / HTTP/1.0\n\n", head), 18);
+}
+
+TEST(HTTPFastParserTest, Invalid) {
+	HTTPRequestHead head;
+
+	EXPECT_EQ(parse("GET  / HTTP/1.1\r\n\r\n", head), HTTPFastParser::HTTP_HEAD_ERROR);
+	EXPECT_EQ(parse("GET /\x01 HTTP/1.1\r\n\r\n", head), HTTPFastParser::HTTP_HEAD_ERROR);
+	EXPECT_EQ(parse("GET / HTTP/2.0\r\n\r\n", head), HTTPFastParser::HTTP_HEAD_ERROR);
+	EXPECT_EQ(parse("GET / HTTP/1.1\r\nBad Name: v\r\n\r\n", head), HTTPFastParser::HTTP_HEAD_ERROR);
+	EXPECT_EQ(parse("GET / HTTP/1.1\r\nA: v\r\n folded\r\n\r\n", head), HTTPFastParser::HTTP_HEAD_ERROR);
+	EXPECT_EQ(parse("GET / HTTP/1.1\r\nA: v\x7f\r\n\r\n", head), HTTPFastParser::HTTP_HEAD_ERROR);
+
+	std::string req = "GET / HTTP/1.1\r\n";
+	for (int i = 0; i <= HTTPRequestHead::HTTP_MAX_HEADERS; ++i) {
+		req += "A: b\r\n";
+	}
+	EXPECT_EQ(parse(req + "\r\n", head), HTTPFastParser::HTTP_HEAD_ERROR);
+}
+
+TEST(HTTPFastParserTest, Chunked) {
+	std::string body = "5;ext=1\r\nhello\r\nA\r\n0123456789\r\n0\r\nX-Trailer: 1\r\n\r\nnext";
+	HTTPChunkedDecoder decoder;
+
+	// Feed the bytes one by one, the data comes as pieces
+	std::string data;
+	size_t pos = 0;
+	HTTPChunkedDecoder::Result ret = HTTPChunkedDecoder::CHUNK_MORE;
+
+	while (ret != HTTPChunkedDecoder::CHUNK_DONE) {
+		size_t used;
+		StrView piece;
+
+		ASSERT_LT(pos, body.size());
+		ret = decoder.decode(body.data() + pos, 1, used, piece);
+		ASSERT_NE(ret, HTTPChunkedDecoder::CHUNK_ERROR);
+		EXPECT_EQ(used, 1U);
+		if (ret == HTTPChunkedDecoder::CHUNK_DATA) {
+			data += piece.to_string();
+		}
+		pos += used;
+	}
+	EXPECT_EQ(data, "hello0123456789");
+	EXPECT_EQ(body.substr(pos), "next");
+
+	size_t used;
+	StrView piece;
+
+	decoder.reset();
+	EXPECT_EQ(decoder.decode("zz\r\n", 4, used, piece), HTTPChunkedDecoder::CHUNK_ERROR);
+	decoder.reset();
+	EXPECT_EQ(decoder.decode("1\r\nab", 5, used, piece), HTTPChunkedDecoder::CHUNK_DATA);
+	EXPECT_EQ(decoder.decode("b", 1, used, piece), HTTPChunkedDecoder::CHUNK_ERROR);
+	decoder.reset();
+	EXPECT_EQ(decoder.decode("1000000000000000\r\n", 18, used, piece), HTTPChunkedDecoder::CHUNK_ERROR);
+}
@@ -0,0 +1,25 @@
+#include "unittest.hpp"
+#include "base/server/http_headers.hpp"
+
+using cppbase::StrView;
+using cppbase::HTTPHeaderId;
+
+TEST(HTTPHeadersTest, KnownId) {
+	for (int i = 0; i < cppbase::HTTP_HEADER_KNOWN_CNT; ++i) {
+		HTTPHeaderId id = static_cast<HTTPHeaderId>(i);
+		std::string name = cppbase::get_http_header_name(id).to_string();
+
+		EXPECT_EQ(cppbase::get_http_header_id(name), id);
+		for (auto it = name.begin(); it != name.end(); ++it) {
+			*it = toupper(*it);
+		}
+		EXPECT_EQ(cppbase::get_http_header_id(name), id);
+	}
+
+	EXPECT_EQ(cppbase::get_http_header_id("host"), cppbase::HTTP_HEADER_HOST);
+	EXPECT_EQ(cppbase::get_http_header_id("content-LENGTH"), cppbase::HTTP_HEADER_CONTENT_LENGTH);
+	EXPECT_EQ(cppbase::get_http_header_id("Hosts"), cppbase::HTTP_HEADER_UNKNOWN);
+	EXPECT_EQ(cppbase::get_http_header_id("X-Custom"), cppbase::HTTP_HEADER_UNKNOWN);
+	EXPECT_EQ(cppbase::get_http_header_id(""), cppbase::HTTP_HEADER_UNKNOWN);
+	EXPECT_TRUE(cppbase::get_http_header_name(cppbase::HTTP_HEADER_UNKNOWN).empty());
+}
@@ -0,0 +1,58 @@
+#include "unittest.hpp"
+#include "core/thread/mpsc_queue.hpp"
+
+#include <thread>
+#include <vector>
+
+using cppbase::MPSCQueue;
+
+TEST(MPSCQueueTest, Order) {
+	MPSCQueue<int> queue;
+	int value;
+
+	EXPECT_TRUE(queue.empty());
+	EXPECT_FALSE(queue.pop(value));
+
+	for (int i = 0; i < 10; ++i) {
+		queue.push(i);
+	}
+	for (int i = 0; i < 10; ++i) {
+		ASSERT_TRUE(queue.pop(value));
+		EXPECT_EQ(value, i);
+	}
+	EXPECT_TRUE(queue.empty());
+}
+
+TEST(MPSCQueueTest, MultiProducer) {
+	const int producers = 4;
+	const int cnt = 100000;
+	MPSCQueue<int> queue;
+	std::vector<std::thread> threads;
+	std::vector<int> last(producers, -1);
+
+	for (int p = 0; p < producers; ++p) {
+		threads.emplace_back([&queue, p, cnt]() {
+			for (int i = 0; i < cnt; ++i) {
+				queue.push(p * cnt + i);
+			}
+		});
+	}
+
+	int popped = 0;
+	while (popped < producers * cnt) {
+		int value;
+		if (!queue.pop(value)) {
+			continue;
+		}
+		// Keep the order of every producer
+		int p = value / cnt;
+		EXPECT_GT(value % cnt, last[p]);
+		last[p] = value % cnt;
+		++popped;
+	}
+
+	for (auto &t : threads) {
+		t.join();
+	}
+	EXPECT_TRUE(queue.empty());
+}
@@ -0,0 +1,208 @@
+#include "unittest.hpp"
+#include "core/net/conn.hpp"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+using cppbase::PacketBuf;
+using cppbase::SharedSlice;
+using cppbase::FileSlice;
+
+static std::string drain(PacketBuf &buf)
+{
+	std::string out;
+
+	while (!buf.empty()) {
+		uint8_t *data;
+		uint32_t size;
+
+		buf.peek_cur_data(&data, &size);
+		out.append(reinterpret_cast<char*>(data), size);
+		buf.consume_bytes(size);
+	}
+	return out;
+}
+
+TEST(PacketBufTest, AppendSliceInOrder) {
+	PacketBuf buf;
+	std::string big(5000, 'b');
+	SharedSlice slice{std::string(big)};
+
+	buf.append_data("head", 4);
+	buf.append_slice(slice);
+	buf.append_data("tail", 4);
+	EXPECT_EQ(buf.total_size(), 5008U);
+	EXPECT_EQ(slice.holder().use_count(), 2);
+
+	struct iovec iov[8];
+	uint32_t cnt = buf.peek_data_iov(iov, 8);
+	ASSERT_EQ(cnt, 3U);
+	EXPECT_EQ(iov[1].iov_base, slice.data());
+
+	EXPECT_EQ(drain(buf), "head" + big + "tail");
+	// The buffer referring to the slice is released after consumed
+	EXPECT_EQ(slice.holder().use_count(), 1);
+
+	buf.append_data("again", 5);
+	EXPECT_EQ(drain(buf), "again");
+}
+
+TEST(PacketBufTest, SharedSliceOnManyBufs) {
+	std::vector<uint8_t> payload(4096, 'x');
+	SharedSlice slice(std::move(payload));
+	PacketBuf buf1, buf2;
+
+	buf1.append_slice(slice);
+	buf2.append_slice(slice.slice(1024, 2048));
+	buf2.append_slice(slice.slice(0, 16));
+	EXPECT_EQ(slice.holder().use_count(), 3);
+
+	EXPECT_EQ(drain(buf1), std::string(4096, 'x'));
+	EXPECT_EQ(drain(buf2), std::string(2064, 'x'));
+	EXPECT_EQ(slice.holder().use_count(), 1);
+}
+
+TEST(PacketBufTest, AppendPacket) {
+	PacketBuf buf, other;
+	std::string data(3000, 'o');
+
+	buf.append_data("1234", 4);
+	other.append_data(data.data(), data.size());
+	other.append_slice(SharedSlice(std::string(data)));
+
+	buf.append_packet(other);
+	EXPECT_TRUE(other.empty());
+	EXPECT_EQ(buf.total_size(), 6004U);
+
+	buf.append_data("5678", 4);
+	EXPECT_EQ(drain(buf), "1234" + data + data + "5678");
+
+	other.append_data("x", 1);
+	EXPECT_EQ(drain(other), "x");
+}
+
+TEST(PacketBufTest, FileRange) {
+	char path[] = "/tmp/packet_buf_test_XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_NE(fd, -1);
+	unlink(path);
+
+	std::string content(100000, 'f');
+	ASSERT_EQ(write(fd, content.data(), content.size()), static_cast<ssize_t>(content.size()));
+
+	PacketBuf buf;
+	buf.append_data("head", 4);
+	buf.append_file(FileSlice::from_fd(fd, 10, 50000));
+	buf.append_data("tail", 4);
+	EXPECT_EQ(buf.total_size(), 50008U);
+
+	// The iovecs stop at the file range
+	struct iovec iov[8];
+	ASSERT_EQ(buf.peek_data_iov(iov, 8), 1U);
+	EXPECT_EQ(iov[0].iov_len, 4U);
+
+	int file_fd;
+	off_t offset;
+	uint32_t size;
+	EXPECT_FALSE(buf.peek_file(&file_fd, &offset, &size));
+	buf.consume_bytes(4);
+	ASSERT_TRUE(buf.peek_file(&file_fd, &offset, &size));
+	EXPECT_EQ(file_fd, fd);
+	EXPECT_EQ(offset, 10);
+	EXPECT_EQ(size, 50000U);
+
+	buf.consume_bytes(1000);
+	ASSERT_TRUE(buf.peek_file(&file_fd, &offset, &size));
+	EXPECT_EQ(offset, 1010);
+
+	// Read the whole range into memory like the io_uring sender
+	while (buf.peek_file(&file_fd, &offset, &size)) {
+		ASSERT_TRUE(buf.read_front_file(16384));
+		ASSERT_GE(buf.peek_data_iov(iov, 8), 1U);
+		buf.consume_bytes(iov[0].iov_len);
+	}
+	EXPECT_EQ(drain(buf), "tail");
+}
+
+TEST(PacketBufTest, LazyBuffer) {
+	PacketBuf buf;
+	uint8_t *data;
+	uint32_t size;
+
+	// Nothing is allocated until the data arrives
+	EXPECT_EQ(buf.buf_cnt(), 0U);
+	buf.peek_cur_data(&data, &size);
+	EXPECT_EQ(size, 0U);
+
+	buf.append_data("abc", 3);
+	EXPECT_EQ(buf.buf_cnt(), 1U);
+	buf.consume_bytes(3);
+	EXPECT_EQ(buf.buf_cnt(), 0U);
+
+	// The spare space reserved by the reader is released too
+	buf.get_left_space(&data, &size, 4096);
+	EXPECT_GE(size, 4096U);
+	buf.release_spare_bufs();
+	EXPECT_EQ(buf.buf_cnt(), 0U);
+}
+
+TEST(PacketBufTest, Linearize) {
+	PacketBuf buf;
+	std::string big(5000, 's');
+	std::string expect = "abc" + big + "xyz";
+
+	EXPECT_TRUE(buf.linearize(1) == NULL);
+	buf.append_data("abc", 3);
+	buf.append_slice(SharedSlice{std::string(big)});
+	buf.append_data("xyz", 3);
+	EXPECT_TRUE(buf.linearize(expect.size() + 1) == NULL);
+
+	// The missing bytes are copied into the room of the head buffer
+	uint8_t *data = buf.linearize(100);
+	ASSERT_TRUE(data != NULL);
+	EXPECT_EQ(std::string(reinterpret_cast<char*>(data), 100), expect.substr(0, 100));
+
+	// All bytes are moved into one new buffer
+	data = buf.linearize(expect.size());
+	ASSERT_TRUE(data != NULL);
+	EXPECT_EQ(std::string(reinterpret_cast<char*>(data), expect.size()), expect);
+	EXPECT_EQ(buf.total_size(), expect.size());
+
+	// The new bytes are still appended in order
+	buf.append_data("end", 3);
+	EXPECT_EQ(drain(buf), expect + "end");
+}
+
+TEST(PacketBufTest, LinearizeLarge) {
+	PacketBuf buf;
+	std::string part(40000, 'l');
+
+	for (int i = 0; i < 3; ++i) {
+		buf.append_slice(SharedSlice{std::string(part)});
+	}
+
+	struct iovec iov[8];
+	EXPECT_EQ(buf.peek_data_iov(iov, 8), 3U);
+
+	uint8_t *data = buf.linearize(100000);
+	ASSERT_TRUE(data != NULL);
+	EXPECT_EQ(std::string(reinterpret_cast<char*>(data), 100000), std::string(100000, 'l'));
+	EXPECT_EQ(buf.peek_data_iov(iov, 8), 2U);
+	EXPECT_EQ(drain(buf), std::string(120000, 'l'));
+}
+
+TEST(PacketBufTest, LinearizeFileRange) {
+	PacketBuf buf;
+	char path[] = "/tmp/packet_buf_test_XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_NE(fd, -1);
+	unlink(path);
+
+	buf.append_data("head", 4);
+	buf.append_file(FileSlice::from_fd(fd, 0, 100));
+	EXPECT_TRUE(buf.linearize(4) != NULL);
+	EXPECT_TRUE(buf.linearize(5) == NULL);
+}
@@ -0,0 +1,84 @@
+#include "unittest.hpp"
+#include "core/event/timer_wheel.hpp"
+
+#include <vector>
+
+using cppbase::TimerWheel;
+
+static const uint64_t TICK = 1000000;
+
+TEST(TimerWheelTest, Expire) {
+	TimerWheel wheel(TICK);
+	std::vector<int> fired;
+
+	wheel.add_timer([&](void *) { fired.push_back(2); }, 2 * TICK, NULL, 0);
+	wheel.add_timer([&](void *) { fired.push_back(1); }, 1 * TICK, NULL, 0);
+	EXPECT_EQ(wheel.size(), 2U);
+	EXPECT_EQ(wheel.next_timeout_nsecs(0), static_cast<int64_t>(TICK));
+
+	EXPECT_EQ(wheel.run_timers(TICK - 1), 0U);
+	EXPECT_EQ(wheel.run_timers(2 * TICK), 2U);
+	ASSERT_EQ(fired.size(), 2U);
+	EXPECT_EQ(fired[0], 1);
+	EXPECT_EQ(fired[1], 2);
+	EXPECT_EQ(wheel.size(), 0U);
+	EXPECT_EQ(wheel.next_timeout_nsecs(2 * TICK), -1);
+}
+
+TEST(TimerWheelTest, Cancel) {
+	TimerWheel wheel(TICK);
+	int fired = 0;
+
+	TimerWheel::TimerId id = wheel.add_timer([&](void *) { ++fired; }, 10 * TICK, NULL, 0);
+	EXPECT_TRUE(wheel.cancel_timer(id));
+	EXPECT_FALSE(wheel.cancel_timer(id));
+
+	// The node is reused, the stale id must not cancel the new timer
+	wheel.add_timer([&](void *) { ++fired; }, 10 * TICK, NULL, 0);
+	EXPECT_FALSE(wheel.cancel_timer(id));
+	EXPECT_FALSE(wheel.cancel_timer(TimerWheel::INVALID_TIMER_ID));
+
+	wheel.run_timers(10 * TICK);
+	EXPECT_EQ(fired, 1);
+}
+
+TEST(TimerWheelTest, Cascade) {
+	TimerWheel wheel(TICK);
+	std::vector<uint64_t> delays = {63, 64, 65, 4095, 4096, 300000, 20000000};
+	std::vector<uint64_t> fired;
+
+	for (auto delay : delays) {
+		wheel.add_timer([&fired, delay](void *) { fired.push_back(delay); }, delay * TICK, NULL, 0);
+	}
+
+	uint64_t now = 0;
+	while (wheel.size()) {
+		int64_t wait = wheel.next_timeout_nsecs(now);
+		ASSERT_GE(wait, 0);
+		now += wait;
+		wheel.run_timers(now);
+		if (!fired.empty()) {
+			// Never expire early
+			EXPECT_GE(now, fired.back() * TICK);
+		}
+	}
+	EXPECT_EQ(fired, delays);
+}
+
+TEST(TimerWheelTest, AddInCallback) {
+	TimerWheel wheel(TICK);
+	int fired = 0;
+	TimerWheel::TimerId victim;
+
+	wheel.add_timer([&](void *) {
+		++fired;
+		wheel.cancel_timer(victim);
+		wheel.add_timer([&](void *) { ++fired; }, 0, NULL, TICK);
+	}, TICK, NULL, 0);
+	victim = wheel.add_timer([&](void *) { fired += 100; }, TICK, NULL, 0);
+
+	wheel.run_timers(TICK);
+	EXPECT_EQ(fired, 1);
+	wheel.run_timers(2 * TICK);
+	EXPECT_EQ(fired, 2);
+}
@@ -1,6 +1,7 @@
 #include "unittest.hpp"
 #include "utils/utils.hpp"
 #include "utils/fs_utils.hpp"
+#include "utils/str_view.hpp"
 #include "timestamp.hpp"
 
 #include <set>
@@ -33,6 +34,19 @@ TEST(UtilTest, Str2Upper) {
 	EXPECT_EQ("IKUAI8.COM", str);
 }
 
+TEST(UtilTest, StrView) {
+	string str = "Content-Length";
+	cppbase::StrView view(str);
+
+	EXPECT_EQ(view.size(), str.size());
+	EXPECT_TRUE(view == cppbase::StrView("Content-Length"));
+	EXPECT_TRUE(view != cppbase::StrView("content-length"));
+	EXPECT_TRUE(view.equal_nocase("content-length"));
+	EXPECT_FALSE(view.equal_nocase("content-type"));
+	EXPECT_EQ(cppbase::StrView(str.data(), 7).to_string(), "Content");
+	EXPECT_TRUE(cppbase::StrView().empty());
+}
+
 TEST(UtilTest, Dir) {
 	int stamp = (int)time(NULL);
 	string dir = "/tmp/" + std::to_string(stamp);